@@ -0,0 +1,285 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file alert.c
+ *  Power event alerts.
+ *  Rules are given as "alert <endpoint> <condition> <command>" lines in the
+ *  config and checked by the client thread against every sample as it is 
+ *  published, straight after the data that completed it has been parsed, so
+ *  an alert does not wait for the next GKrellM second tick. A rule fires when
+ *  its condition becomes true (and again only once it has been false), 
+ *  which makes a status flag rule like "OB" an OL to OB transition.
+ *
+ *  The client thread never runs anything itself - fork()ing a large process 
+ *  can take a while - it queues the action for the alert thread, which runs 
+ *  the command with /bin/sh and records the time from the data arriving to
+ *  the command being started in the "alert" histogram (see stats.c). The 
+ *  command gets the condition, the endpoint and the value (or the status 
+ *  flags) that set it off as $1, $2 and $3.
+ */
+/*  $Id: alert.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<stdio.h>
+#include<string.h>
+#include"alert.h"
+#include"format.h"
+#include"stats.h"
+
+#define ALERT_ARGS   8     /*!< Entries in an action's argv, including the terminating NULL. */
+
+/*! An action queued for the alert thread. */
+typedef struct
+{
+    gchar  **argv;                    /*!< /bin/sh -c <command> bups-alert <condition> <endpoint> <value> */
+    gint64   received;                /*!< stats_now() when the data that set the alert off was read. */
+} AlertAction;
+
+static BUPSAlert    alerts[MAX_ALERTS];  /*!< The rules, only used by the client thread once it starts. */
+static gint         alert_count = 0;     /*!< Number of valid entries in alerts.                  */
+static GAsyncQueue *queue  = NULL;       /*!< Actions waiting for the alert thread.               */
+static GThread     *runner = NULL;       /*!< The alert thread, NULL if it is not running.        */
+static AlertAction  stop_action;         /*!< Queued by alert_stop() to tell the alert thread to exit. */
+
+
+/*****************************************************************************\
+* Rule handling.                                                              *
+\*****************************************************************************/ 
+
+/** Parse a rule and add it to the rule list.
+ *  This must not be called while the client thread is running.
+ *
+ *  \par Arguments:
+ *  \arg \c rule - The rule, "<endpoint> <condition> <command>".
+ *  \return TRUE if the rule was added, FALSE if it could not be understood
+ *  (a message saying why is printed) or there are already MAX_ALERTS rules.
+ */
+gboolean alert_add(const gchar *rule)
+{
+    BUPSAlert *alert;
+    gchar      condition[64];
+    gchar     *compare, *end;
+    gint       offset = 0, len;
+
+    if(alert_count >= MAX_ALERTS) {
+        fprintf(stderr, "alert_add: too many alerts, ignoring '%s'\n", rule);
+        return FALSE;
+    }
+
+    alert = &alerts[alert_count];
+    if((2 != sscanf(rule, "%d %63s %n", &alert -> endpoint, condition, &offset)) || 
+       !offset || !rule[offset] || (alert -> endpoint < 0) || (alert -> endpoint >= MAX_ENDPOINTS)) {
+        fprintf(stderr, "alert_add: expected '<endpoint> <condition> <command>', got '%s'\n", rule);
+        return FALSE;
+    }
+
+    if((compare = strpbrk(condition, "<>")) != NULL) {
+        /* threshold on one of the values */
+        alert -> op     = *compare;
+        alert -> metric = format_metric(condition, compare - condition);
+        alert -> limit  = g_ascii_strtod(compare + 1, &end);
+        if((alert -> metric < 0) || (end == compare + 1) || *end) {
+            fprintf(stderr, "alert_add: bad threshold '%s'\n", condition);
+            return FALSE;
+        }
+    } else {
+        /* a NUT status flag appearing, or going away with a ! in front */
+        alert -> metric = -1;
+        alert -> op     = (*condition == '!') ? '-' : '+';
+        len = strlen(condition + (alert -> op == '-'));
+        if(!len || (len >= ALERT_FLAG_SIZE)) {
+            fprintf(stderr, "alert_add: bad status flag '%s'\n", condition);
+            return FALSE;
+        }
+        strcpy(alert -> flag, condition + (alert -> op == '-'));
+    }
+
+    alert -> condition = g_strdup(condition);
+    alert -> command   = g_strdup(rule + offset);
+    alert -> active    = FALSE;
+    alert_count++;
+
+    return TRUE;
+}
+
+
+/** Discard all the rules.
+ *  This must not be called while the client thread is running.
+ */
+void alert_clear(void)
+{
+    gint rule;
+
+    for(rule = 0; rule < alert_count; ++rule) {
+        g_free(alerts[rule].condition);
+        g_free(alerts[rule].command);
+    }
+    alert_count = 0;
+}
+
+
+/** Hand a rule's command to the alert thread.
+ *  If the alert thread has fallen a long way behind the action is dropped
+ *  rather than let the queue grow without limit.
+ */
+static void alert_queue(BUPSAlert *alert, gint endpoint, const gchar *value, gint64 received)
+{
+    AlertAction *action;
+
+    if(g_async_queue_length(queue) >= ALERT_QUEUE_MAX) {
+        fprintf(stderr, "alert_queue: alert thread is behind, dropped '%s'\n", alert -> condition);
+        return;
+    }
+
+    action = g_new(AlertAction, 1);
+    action -> argv = g_new(gchar *, ALERT_ARGS);
+    action -> argv[0] = g_strdup("/bin/sh");
+    action -> argv[1] = g_strdup("-c");
+    action -> argv[2] = g_strdup(alert -> command);
+    action -> argv[3] = g_strdup("bups-alert");
+    action -> argv[4] = g_strdup(alert -> condition);
+    action -> argv[5] = g_strdup_printf("%d", endpoint);
+    action -> argv[6] = g_strdup(value);
+    action -> argv[7] = NULL;
+    action -> received = received;
+
+    g_async_queue_push(queue, action);
+}
+
+
+/** Check a newly published sample against the rules.
+ *  This is called by the client thread for every sample it publishes. Nothing
+ *  is tested without valid values, so a lost connection does not look 
+ *  like a flat battery, and flag rules are skipped for servers (Belkin) 
+ *  that do not report status flags.
+ *
+ *  \par Arguments:
+ *  \arg \c endpoint - Index of the endpoint the sample is from.
+ *  \arg \c sample - The sample.
+ *  \arg \c status - The NUT status flags for the sample, NULL if there are none.
+ *  \arg \c received - stats_now() when the data that completed the sample arrived.
+ */
+void alert_evaluate(gint endpoint, struct UPSData *sample, const gchar *status, gint64 received)
+{
+    BUPSAlert *alert;
+    gboolean   holds;
+    gfloat     value = 0.0;
+    gchar      text[32];
+    gint       rule;
+
+    if(!runner || !sample -> ups_Valid) return;
+
+    for(rule = 0; rule < alert_count; ++rule) {
+        alert = &alerts[rule];
+        if(alert -> endpoint != endpoint) continue;
+
+        if(alert -> metric >= 0) {
+            value = *(gfloat *)((gchar *)sample + format_metrics[alert -> metric].offset);
+            holds = (alert -> op == '<') ? (value < alert -> limit) : (value > alert -> limit);
+        } else {
+            if(!status) continue;
+            holds = (format_has_flag(status, alert -> flag) == (alert -> op == '+'));
+        }
+
+        if(holds && !alert -> active) {
+            if(alert -> metric >= 0) {
+                g_ascii_formatd(text, sizeof(text), "%.1f", value);
+                alert_queue(alert, endpoint, text, received);
+            } else {
+                alert_queue(alert, endpoint, status, received);
+            }
+        }
+        alert -> active = holds;
+    }
+}
+
+
+/*****************************************************************************\
+* Alert thread.                                                               *
+\*****************************************************************************/ 
+
+/** Release an action and everything it holds. */
+static void action_free(AlertAction *action)
+{
+    g_strfreev(action -> argv);
+    g_free(action);
+}
+
+
+/** Alert thread start routine.
+ *  Runs each action as it is queued until alert_stop() queues stop_action.
+ *  g_spawn_async() closes the descriptors the child inherits (the client 
+ *  sockets among them) and reaps it, so nothing is left behind.
+ */
+static gpointer alert_run(gpointer arg)
+{
+    AlertAction *action;
+    GError      *error = NULL;
+
+    while((action = g_async_queue_pop(queue)) != &stop_action) {
+        if(!g_spawn_async(NULL, action -> argv, NULL, 0, NULL, NULL, NULL, &error)) {
+            fprintf(stderr, "alert_run: unable to run '%s': %s\n", action -> argv[2], error -> message);
+            g_error_free(error);
+            error = NULL;
+        }
+        stats_since(STAT_ALERT, action -> received);
+        action_free(action);
+    }
+
+    return NULL;
+}
+
+
+/** Start the alert thread, if there are any rules for it to act on.
+ *
+ *  \return TRUE if the thread is running, FALSE if there are no rules or it could not be started.
+ */
+gboolean alert_start(void)
+{
+    if(runner) return TRUE;
+    if(!alert_count) return FALSE;
+
+    if(!queue) queue = g_async_queue_new();
+    if((runner = g_thread_create(alert_run, NULL, TRUE, NULL)) == NULL) {
+        fprintf(stderr, "alert_start: unable to create the alert thread\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/** Stop the alert thread.
+ *  Any actions still queued are discarded. This must be called after the 
+ *  client thread has exited, so nothing else can be queued.
+ */
+void alert_stop(void)
+{
+    AlertAction *action;
+    gint         rule;
+
+    if(!runner) return;
+
+    /* drop the backlog first, so the thread exits after at most the action it is running */
+    while((action = g_async_queue_try_pop(queue)) != NULL) action_free(action);
+
+    g_async_queue_push(queue, &stop_action);
+    g_thread_join(runner);
+    runner = NULL;
+
+    /* a new client thread starts from scratch */
+    for(rule = 0; rule < alert_count; ++rule) alerts[rule].active = FALSE;
+}
@@ -0,0 +1,54 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file alert.h
+ *  Functions exported by alert.c, the power event rules run by the client thread.
+ */
+/*  $Id: alert.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _ALERT_H
+#define _ALERT_H 1
+
+#include<glib.h>
+#include"ups_connect.h"
+
+#define ALERT_FLAG_SIZE   8    /*!< Longest NUT status flag a rule can test for, plus the nul. */
+#define ALERT_QUEUE_MAX   32   /*!< Actions waiting to run before new ones are dropped.        */
+
+/*! A single alert rule, parsed from "<endpoint> <condition> <command>".
+ *  The condition is either a threshold on one of format_metrics[] 
+ *  ("bat_level<30", "temp>45") or a NUT status flag ("OB", or "!OL" for the 
+ *  flag going away). The command is run each time the condition becomes true.
+ */
+typedef struct
+{
+    gint         endpoint;            /*!< Endpoint the rule watches, 0 is the server selected in the config. */
+    gint         metric;              /*!< format_metrics[] index of the value tested, -1 for a status flag. */
+    gchar        op;                  /*!< '<' or '>' for thresholds, '+' (flag set) or '-' (flag clear) for flags. */
+    gfloat       limit;               /*!< Threshold the value is compared with.                 */
+    gchar        flag[ALERT_FLAG_SIZE]; /*!< Status flag tested.                                 */
+    gchar       *condition;           /*!< The condition as configured, passed to the command.   */
+    gchar       *command;             /*!< Shell command run when the condition becomes true.    */
+    gboolean     active;              /*!< TRUE if the condition held for the last sample.       */
+} BUPSAlert;
+
+extern gboolean alert_add     (const gchar *rule);
+extern void     alert_clear   (void);
+extern gboolean alert_start   (void);
+extern void     alert_stop    (void);
+extern void     alert_evaluate(gint endpoint, struct UPSData *sample, const gchar *status, gint64 received);
+
+#endif /* #ifndef _ALERT_H */
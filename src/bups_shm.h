@@ -0,0 +1,185 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file bups_shm.h
+ *  Layout of the shared memory segment the plugin publishes samples in, and
+ *  the functions local programs need to read it. 
+ *
+ *  This header doesn't need glib or anything else from the plugin, so it can
+ *  be copied into other programs. Typical use:
+ *
+ * <PRE>
+ *  const BUPSShm  *shm = bups_shm_open(NULL);
+ *  BUPSShmSample   sample;
+ *
+ *  if(shm && bups_shm_latest(shm, &sample, NULL, 0)) printf("%.1f\n", sample.in_voltage);
+ * </PRE>
+ *
+ *  Link with -lrt on older systems for shm_open().
+ */
+/*  $Id: bups_shm.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _BUPS_SHM_H
+#define _BUPS_SHM_H 1
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+
+#define BUPS_SHM_PREFIX   "/gkrellmbups."  /*!< Segment name is this followed by the uid of the publisher. */
+#define BUPS_SHM_MAGIC    0x53505542       /*!< "BUPS", first word of the segment.                         */
+#define BUPS_SHM_VERSION  2                /*!< Changes whenever the layout does.                          */
+#define BUPS_SHM_RING     64               /*!< Number of recent samples kept.                             */
+#define BUPS_SHM_LOGSIZE  256              /*!< Room for the last log message, including the terminator.   */
+#define BUPS_SHM_RETRIES  1000             /*!< Times a reader retries a copy torn by the publisher.       */
+
+/*! A single published sample, 64 bytes. */
+typedef struct
+{
+    int64_t  time;                   /*!< Wall clock time of the sample (seconds since the epoch). */
+    float    bat_voltage;            /*!< Battery voltage.                            */
+    float    bat_level;              /*!< Battery level (percent).                    */
+    float    in_freq;                /*!< Input frequency.                            */
+    float    in_voltage;             /*!< Input voltage.                              */
+    float    out_freq;               /*!< Output frequency.                           */
+    float    out_voltage;            /*!< Output voltage.                             */
+    float    load;                   /*!< Load level (percent).                       */
+    float    temp;                   /*!< UPS temperature.                            */
+    int32_t  present;                /*!< 1 if the UPS is connected.                  */
+    uint32_t log_seq;                /*!< Changes whenever the log message does.      */
+    uint32_t number;                 /*!< Sample number, from 1.                      */
+    int32_t  valid;                  /*!< 1 if the values were read from the UPS, 0 while disconnected. */
+    uint32_t reserved[2];            /*!< Pads the sample out to 64 bytes.            */
+} BUPSShmSample;
+
+/*! The shared memory segment.
+ *  Everything after seq is written under a sequence lock: seq is odd while
+ *  the publisher is updating the segment, so a reader copies what it wants,
+ *  then checks seq is even and unchanged, and tries again if not.
+ */
+typedef struct
+{
+    uint32_t      magic;             /*!< BUPS_SHM_MAGIC.                             */
+    uint32_t      version;           /*!< BUPS_SHM_VERSION.                           */
+    int32_t       pid;               /*!< Process publishing the samples.             */
+    volatile uint32_t seq;           /*!< Sequence lock, odd while being written.     */
+    uint32_t      count;             /*!< Samples published, the latest is ring[(count - 1) % BUPS_SHM_RING]. */
+    uint32_t      reserved[11];      /*!< Pads the header out to 64 bytes.            */
+    char          log[BUPS_SHM_LOGSIZE];   /*!< Last log message.                     */
+    BUPSShmSample ring[BUPS_SHM_RING];     /*!< Most recent samples.                  */
+} BUPSShm;
+
+/* shm.c, which writes the segment, only wants the layout */
+#ifndef BUPS_SHM_WRITER
+
+/** Map the segment published by a user's plugin, read only.
+ *  The segment must belong to the user it is named after (the current user
+ *  for a name that doesn't start with BUPS_SHM_PREFIX) and must not be 
+ *  writable by anyone else, otherwise any local user could feed us values.
+ *
+ *  \par Arguments:
+ *  \arg \c name - Segment name, NULL for the one published as the current user.
+ *  \return The segment, or NULL if it doesn't exist, isn't one we understand
+ *  or can't be trusted.
+ */
+static const BUPSShm *bups_shm_open(const char *name)
+{
+    char           own[32];
+    int            fd;
+    uid_t          uid = getuid();
+    struct stat    st;
+    const BUPSShm *shm;
+
+    if(!name) {
+        snprintf(own, sizeof(own), BUPS_SHM_PREFIX "%u", (unsigned)uid);
+        name = own;
+    } else if(!strncmp(name, BUPS_SHM_PREFIX, strlen(BUPS_SHM_PREFIX))) {
+        uid = (uid_t)strtoul(name + strlen(BUPS_SHM_PREFIX), NULL, 10);
+    }
+
+    if((fd = shm_open(name, O_RDONLY, 0)) < 0) return NULL;
+    if((fstat(fd, &st) < 0) || (st.st_uid != uid) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        close(fd);
+        return NULL;
+    }
+    shm = (const BUPSShm *)mmap(NULL, sizeof(BUPSShm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(shm == (const BUPSShm *)MAP_FAILED) return NULL;
+    if((shm -> magic != BUPS_SHM_MAGIC) || (shm -> version != BUPS_SHM_VERSION)) {
+        munmap((void *)shm, sizeof(BUPSShm));
+        return NULL;
+    }
+
+    return shm;
+}
+
+
+/** Copy the most recent samples out of the segment.
+ *
+ *  \par Arguments:
+ *  \arg \c shm - Segment returned by bups_shm_open().
+ *  \arg \c samples - Filled with up to max samples, newest first.
+ *  \arg \c max - Room in samples (no more than BUPS_SHM_RING are ever copied).
+ *  \arg \c log - If not NULL, filled with the last log message.
+ *  \arg \c size - Size of log.
+ *  \return The number of samples copied, 0 if nothing has been published.
+ */
+static int bups_shm_recent(const BUPSShm *shm, BUPSShmSample *samples, int max, char *log, size_t size)
+{
+    uint32_t seq, count;
+    int      tries, copied;
+
+    for(tries = 0; tries < BUPS_SHM_RETRIES; ++tries) {
+        seq = shm -> seq;
+        __sync_synchronize();
+        if(seq & 1) continue;
+
+        count = shm -> count;
+        for(copied = 0; (copied < max) && (copied < BUPS_SHM_RING) && ((uint32_t)copied < count); ++copied) {
+            samples[copied] = shm -> ring[(count - 1 - copied) % BUPS_SHM_RING];
+        }
+        if(log && size) {
+            strncpy(log, shm -> log, size - 1);
+            log[size - 1] = '\0';
+        }
+
+        __sync_synchronize();
+        if(seq == shm -> seq) return copied;
+    }
+
+    return 0;
+}
+
+
+/** Copy the latest sample out of the segment.
+ *
+ *  \return 1 if there was a sample, 0 if nothing has been published.
+ */
+static int bups_shm_latest(const BUPSShm *shm, BUPSShmSample *sample, char *log, size_t size)
+{
+    return bups_shm_recent(shm, sample, 1, log, size);
+}
+
+#endif /* #ifndef BUPS_SHM_WRITER */
+
+#endif /* #ifndef _BUPS_SHM_H */
@@ -0,0 +1,124 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file bupsread.c
+ *  Command line reader for the shared memory segment the plugin publishes.
+ *  Prints the latest UPS values without going near the UPS server, for 
+ *  scripts and shutdown tools.
+ *
+ * <PRE>
+ * bupsread [-n segment] [-r] [field ...]
+ * </PRE>
+ *
+ *  With no fields every value is printed as "name value" lines, otherwise 
+ *  just the values asked for, one per line. -r prints the recent samples, 
+ *  newest first, one per line. The exit status is 1 if there is no segment
+ *  or nothing has been published yet.
+ */
+/*  $Id: bupsread.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include"bups_shm.h"
+
+/*! Field names, the same as the ${name} chart format codes. */
+static const char *field_names[] = { "in_volt", "out_volt", "bat_volt", "bat_level", "in_freq", 
+                                     "out_freq", "load", "temp", "present", "valid", "time", "log", NULL };
+
+
+/** Print one field of a sample.
+ *
+ *  \return 0 if the field name was recognised, 1 otherwise.
+ */
+static int print_field(const char *name, BUPSShmSample *sample, const char *log)
+{
+    if(!strcmp(name, "in_volt"))   printf("%.1f\n", sample -> in_voltage);
+    else if(!strcmp(name, "out_volt"))  printf("%.1f\n", sample -> out_voltage);
+    else if(!strcmp(name, "bat_volt"))  printf("%.1f\n", sample -> bat_voltage);
+    else if(!strcmp(name, "bat_level")) printf("%.1f\n", sample -> bat_level);
+    else if(!strcmp(name, "in_freq"))   printf("%.1f\n", sample -> in_freq);
+    else if(!strcmp(name, "out_freq"))  printf("%.1f\n", sample -> out_freq);
+    else if(!strcmp(name, "load"))      printf("%.1f\n", sample -> load);
+    else if(!strcmp(name, "temp"))      printf("%.1f\n", sample -> temp);
+    else if(!strcmp(name, "present"))   printf("%d\n",   sample -> present);
+    else if(!strcmp(name, "valid"))     printf("%d\n",   sample -> valid);
+    else if(!strcmp(name, "time"))      printf("%lld\n", (long long)sample -> time);
+    else if(!strcmp(name, "log"))       printf("%s\n",   log);
+    else {
+        fprintf(stderr, "bupsread: unknown field '%s'\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const BUPSShm *shm;
+    BUPSShmSample  samples[BUPS_SHM_RING];
+    char           log[BUPS_SHM_LOGSIZE];
+    const char    *name = NULL;
+    int            recent = 0, count, arg, field, status = 0;
+
+    while((arg = getopt(argc, argv, "n:rh")) != -1) {
+        switch(arg) {
+            case 'n': name = optarg; break;
+            case 'r': recent = 1; break;
+            default:  fprintf(stderr, "usage: bupsread [-n segment] [-r] [field ...]\nfields:");
+                      for(field = 0; field_names[field]; ++field) fprintf(stderr, " %s", field_names[field]);
+                      fprintf(stderr, "\n");
+                      return 2;
+        }
+    }
+
+    if(!(shm = bups_shm_open(name))) {
+        fprintf(stderr, "bupsread: no GKrellMBUPS shared memory segment, is the plugin running?\n");
+        return 1;
+    }
+
+    if(recent) {
+        count = bups_shm_recent(shm, samples, BUPS_SHM_RING, log, sizeof(log));
+    } else {
+        count = bups_shm_latest(shm, samples, log, sizeof(log));
+    }
+    if(!count) {
+        fprintf(stderr, "bupsread: nothing has been published yet\n");
+        return 1;
+    }
+
+    if(recent) {
+        for(arg = 0; arg < count; ++arg) {
+            printf("%lld %d %.1f %.1f %.1f %.1f %.1f %.1f %.1f %.1f\n", (long long)samples[arg].time, 
+                   samples[arg].present, samples[arg].in_voltage, samples[arg].out_voltage, 
+                   samples[arg].bat_voltage, samples[arg].bat_level, samples[arg].in_freq,
+                   samples[arg].out_freq, samples[arg].load, samples[arg].temp);
+        }
+    } else if(optind == argc) {
+        for(field = 0; field_names[field]; ++field) {
+            printf("%s ", field_names[field]);
+            print_field(field_names[field], &samples[0], log);
+        }
+    } else {
+        for(arg = optind; arg < argc; ++arg) {
+            status |= print_field(argv[arg], &samples[0], log);
+        }
+    }
+
+    return status ? 2 : 0;
+}
@@ -21,9 +21,14 @@
 /*  $Id: chart.c,v 1.2 2003/02/06 21:07:53 chris Exp $
  */
 
+#include<string.h>
 #include"chart.h"
 #include"gkrellmbups.h"
 #include"ups_connect.h"
+#include"history.h"
+#include"rollup.h"
+#include"format.h"
+#include"stats.h"
 
 /*! Convenience macro to make limiting values to l or greater easier. */
 #define LIM_FLOOR(x, l) ((x) < (l)) ? (l) : (x)
@@ -33,160 +38,193 @@
 
 #define DEFAULT_CHARTHEIGHT  40             /*!< 40 is probably a good trade between detail and screen use */  
 
-/*! chart config names for the voltage chart data entries     */
-static gchar *volt_names[] = { "Input voltage", "Output voltage", "Battery voltage", NULL };
+/*! Options listed in the voltage chart format popup */
+static gchar *voltage_options[] = 
+{
+    "i:\\f$i,\\.o:\\f$o,\\nb:\\f$b",
+    "i:\\f$i,\\.o:\\f$o,\\nb:\\f$l%",
+    "i:\\f$i,\\.o:\\f$o",
+    "i:\\f$i\\no:\\f$o",
+    NULL
+};
+
+/*! Options listed in the frequency chart format popup */
+static gchar *frequency_options[] = 
+{
+    "i:\\f$i\\no:\\f$o",
+    "i:\\f$i,\\.o:\\f$o",
+    NULL
+};
 
-/*! chart config names for the frequency chart data entries   */
-static gchar *freq_names[] = { "Input frequency", "Output frequency", NULL };
+/*! Options listed in the temperature/load chart format popup */
+static gchar *temperature_options[] =
+{
+    "t:\\f$tC\\nl:\\f$l%",
+    "t:\\f$tC,\\.l:\\f$l%",
+    NULL
+};
 
-/*! chart config names for the temperature chart data entries */
-static gchar *temp_names[] = { "Temperature", "Load", NULL };
+/*! The charts shown when the config doesn't define any. Charts defined in the 
+ *  config with one of these keys get its $ codes, format popup and default format.
+ */
+static struct
+{
+    const gchar          *key;
+    const gchar          *metrics;
+    const gchar          *label;
+    const BUPSFormatCode *codes;
+    gchar               **options;
+    gchar                *format;
+} chart_defaults[] =
+{
+    { "volt", "in_volt,out_volt,bat_volt", "Voltages", format_volt_codes, voltage_options,     DEFAULT_VFORMAT },
+    { "freq", "in_freq,out_freq",          "Freq",     format_freq_codes, frequency_options,   DEFAULT_FFORMAT },
+    { "temp", "temp,load",                 "Stats",    format_temp_codes, temperature_options, DEFAULT_TFORMAT },
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
 
 
 /*****************************************************************************\
-* Chart text formatting functions.                                            *
+* Chart data storage functions.                                               *
 \*****************************************************************************/ 
 
-/** Voltage chart text formatter.
- *  This replaces special "$" codes in the specified format sttring with
- *  values taken from upsStatus. Please see the switch in the body of the
- *  function for details about which codes are recognised. All unrecognised
- *  codes or other characters are simply copied to the buffer.
- *
- *  \par Arguments:
- *  \arg \c buffer - Destination buffer.
- *  \arg \c size - number of characters available in buffer (not including newline).
- *  \arg \c format - Format string to process into buffer.
- *
- *  \todo Find a way to unify formatVoltText(), formatFreqText() and 
- *  formatTempText() to reduce the amount of replication between them (maybe
- *  use varargs and pass the values to replace code with in that way?)
- */
-/*  NOTE: Safe for 1.0 and 2.0 
- */
-static void format_volt_text(gchar *buffer, gint size, gchar *format)
-{
-    gchar *fpos;
-    gchar  opt;
-    gint   len;
-
-    size--;
-    *buffer = '\0';
-
-    if(format) {
-        for(fpos = format; (*fpos != '\0') && (size != 0); fpos ++) {
-            len = 1;
-            if((*fpos == '$') && (*(fpos + 1) != '\0')) {
-                opt = *(fpos + 1);
-                switch(opt) {
-                    /* $i - input voltage (in volts) */
-                    case 'i': len = snprintf(buffer, size, "%3.1f", ups_status.in_Voltage ); fpos ++; break;
-                    /* $o - output voltage (in volts) */
-                     case 'o': len = snprintf(buffer, size, "%3.1f", ups_status.out_Voltage); fpos ++; break;
-                    /* $b - batteryvoltage (in volts) */
-                    case 'b': len = snprintf(buffer, size, "%3.1f", ups_status.bat_Voltage); fpos ++; break;
-                    /* $l - battery level as a percentage. */
-                    case 'l': len = snprintf(buffer, size, "%3.1f", ups_status.bat_Level  ); fpos ++; break;
-                    default: *buffer = *fpos; break;
-                }
-            } else {
-                *buffer = *fpos;
-            }
-            
-            size -= len;
-            buffer += len;
+/** Store one column in a chart, remembering whether it is a gap.
+ *  gkrellm_store_chartdata() takes one value for each chartdata the chart has,
+ *  so passing MAX_DATA values covers any chart. 
+ */
+static void store_column(BUPSChart *chart, gint *values, gboolean gap)
+{
+    gkrellm_store_chartdata(chart -> chart, 0, values[0], values[1], values[2], values[3], 
+                                               values[4], values[5], values[6], values[7]);
+    chart -> gaps[chart -> stored++ % GAP_HISTORY] = gap;
+    chart -> dirty = TRUE;
+}
+
+
+/** Store a sample in a chart.
+ *  Every value the chart plots is stored, mains voltages less the mains offset.
+ *  A sample without valid values (the connection or UPS was lost) is stored
+ *  as a gap rather than zeros, which would look just like a power cut. The 
+ *  last valid values are stored again so the trace doesn't plunge, and 
+ *  draw_gaps() blanks the column out. A gap is also put in before a sample 
+ *  that follows a long silence, including the time GKrellM wasn't running
+ *  between the samples replayed from the history file and the live ones,
+ *  and for samples the client dropped because the UI fell behind.
+ */
+static void store_chart(BUPSChart *chart, struct UPSData *sample)
+{
+    const BUPSMetric *metric;
+    gint              entry;
+    gboolean          silent = FALSE;
+
+    /* replayed samples have no monotonic stamp, the wall clock spans restarts */
+    if(chart -> stamp && sample -> ups_Stamp) {
+        silent = (sample -> ups_Stamp - chart -> stamp) > GAP_SILENCE;
+    } else if(chart -> time && sample -> ups_Time) {
+        silent = (sample -> ups_Time - chart -> time) > (GAP_SILENCE / 1000);
+    }
+    if(silent || sample -> ups_Lost) store_column(chart, chart -> last, TRUE);
+    chart -> stamp = sample -> ups_Stamp;
+    chart -> time  = sample -> ups_Time;
+
+    if(sample -> ups_Valid) {
+        for(entry = 0; entry < chart -> metric_count; ++entry) {
+            metric = &format_metrics[chart -> metrics[entry]];
+            chart -> last[entry] = (gint)*(gfloat *)((gchar *)sample + metric -> offset);
+            if(metric -> mains) chart -> last[entry] -= bups_data -> config -> mains;
+            chart -> last[entry] = LIM_FLOOR(chart -> last[entry], 0);
         }
-        *buffer = '\0';
-    } else {
-        g_snprintf(buffer, size, "No format");
-    }  
+    }
+
+    store_column(chart, chart -> last, !sample -> ups_Valid);
 }
 
 
-/** Frequency chart text formatter.
- *  This does much the same thing as formatVoltText() except for the frequency chart.
+/** Store a sample in one chart, or in every chart showing live samples of
+ *  the first endpoint.
+ *  Used both for live samples and for the ones replayed from the history 
+ *  file and rollups, so the charts look the same either way. Hidden charts 
+ *  still have their samples stored, they are only not drawn.
  *
  *  \par Arguments:
- *  \arg \c buffer - Destination buffer.
- *  \arg \c size - number of characters available in buffer (not including newline).
- *  \arg \c format - Format string to process into buffer.
- */
-/*  NOTE: Safe for 1.0 and 2.0 
- */
-static void format_freq_text(gchar *buffer, gint size, gchar *format)
-{
-    gchar *fpos;
-    gchar  opt;
-    gint   len;
-
-    size--;
-    *buffer = '\0';
-
-    if(format) {
-        for(fpos = format; (*fpos != '\0') && (size != 0); fpos ++) {
-            len = 1;
-            if((*fpos == '$') && (*(fpos + 1) != '\0')) {
-                opt = *(fpos + 1);
-                switch(opt) {
-                    case 'i': len = snprintf(buffer, size, "%2.1f", ups_status.in_Freq ); fpos ++; break;
-                    case 'o': len = snprintf(buffer, size, "%2.1f", ups_status.out_Freq); fpos ++; break;
-                    default: *buffer = *fpos; break;
-                }
-            } else {
-                *buffer = *fpos;
-            }
+ *  \arg \c sample - The sample to store.
+ *  \arg \c data - The BUPSChart to store it in, NULL for all the live charts.
+ */
+static void store_sample(struct UPSData *sample, gpointer data)
+{
+    BUPSChart *chart;
+    gint       entry;
 
-            size -= len;
-            buffer += len;
+    if(data) {
+        store_chart((BUPSChart *)data, sample);
+        return;
+    }
+
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        chart = bups_data -> charts[entry];
+        if(!chart -> endpoint && (chart -> resolution == ROLLUP_SECOND)) {
+            store_chart(chart, sample);
         }
-        *buffer = '\0';
+    }
+}
+
+
+/** Refill a chart from scratch at its current resolution.
+ *  Live charts come from the history file, the others from the rollups. Only
+ *  the first endpoint has a history, charts of the others start out empty.
+ */
+static void fill_chart(BUPSChart *chart)
+{
+    gkrellm_reset_chart(chart -> chart);
+    chart -> stored = 0;
+    chart -> stamp  = 0;
+    chart -> time   = 0;
+
+    if(chart -> endpoint) return;
+
+    if(chart -> resolution == ROLLUP_SECOND) {
+        history_replay(gkrellm_chart_width(), store_sample, chart);
     } else {
-        g_snprintf(buffer, size, "No format");
-    }  
+        rollup_replay(chart -> resolution, gkrellm_chart_width(), store_sample, chart);
+    }
+}
+
+
+/** Add a sample replayed from the history file to the rollups.
+ *  Called for the whole history at startup, so the minute and hour charts
+ *  have the last hour in them straight away rather than starting empty.
+ */
+static void seed_rollups(struct UPSData *sample, gpointer data)
+{
+    rollup_add(sample, sample -> ups_Time, NULL);
 }
 
 
-/** Frequency chart text formatter.
- *  This does much the same thing as formatVoltText() except for the 
- *  temperature chart.
+/** Store a completed rollup bucket in each chart plotting that tier.
+ *  Periods with no samples at all (GKrellM or the machine wasn't running)
+ *  follow it as gaps, one column each up to the width of the chart, so the
+ *  time axis isn't squashed.
  *
  *  \par Arguments:
- *  \arg \c buffer - Destination buffer.
- *  \arg \c size - number of characters available in buffer (not including newline).
- *  \arg \c format - Format string to process into buffer.
- */
-/*  NOTE: Safe for 1.0 and 2.0 
- */
-static void format_temp_text(gchar *buffer, gint size, gchar *format)
-{
-    gchar *fpos;
-    gchar  opt;
-    gint   len;
-
-    size--;
-    *buffer = '\0';
-
-    if(format) {
-        for(fpos = format; (*fpos != '\0') && (size != 0); fpos ++) {
-            len = 1;
-            if((*fpos == '$') && (*(fpos + 1) != '\0')) {
-                opt = *(fpos + 1);
-                switch(opt) {
-                    case 't': len = snprintf(buffer, size, "%2.1f", ups_status.ups_Temp); fpos ++; break;
-                    case 'l': len = snprintf(buffer, size, "%3.1f", ups_status.ups_Load); fpos ++; break;
-                    default: *buffer = *fpos; break;
-                }
-            } else {
-                *buffer = *fpos;
-            }
-
-            size -= len;
-            buffer += len;
+ *  \arg \c completed - Bitmask of completed tiers, as returned by rollup_add().
+ *  \arg \c skipped - Periods each tier skipped, as set by rollup_add().
+ */
+static void store_rollups(guint completed, gint *skipped)
+{
+    struct UPSData average;
+    BUPSChart     *chart;
+    gint           entry, gap, gaps;
+
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        chart = bups_data -> charts[entry];
+        if((chart -> resolution != ROLLUP_SECOND) && (completed & (1 << chart -> resolution))) {
+            rollup_average(chart -> resolution, skipped[chart -> resolution] + 1, &average);
+            store_chart(chart, &average);
+
+            gaps = MIN(skipped[chart -> resolution], gkrellm_chart_width());
+            for(gap = 0; gap < gaps; ++gap) store_column(chart, chart -> last, TRUE);
         }
-        *buffer = '\0';
-    } else {
-        g_snprintf(buffer, size, "No format");
-    }  
+    }
 }
 
 
@@ -194,57 +232,130 @@ static void format_temp_text(gchar *buffer, gint size, gchar *format)
 * Chart and panel drawing functions.                                          *
 \*****************************************************************************/ 
 
+/** Blank out the columns of a chart that are gaps.
+ *  The newest sample is in the rightmost column. Each run of gap columns is
+ *  covered by the chart background (grid lines and all) in one go.
+ */
+static void draw_gaps(BUPSChart *chart)
+{
+    GkrellmChart *cp = chart -> chart;
+    gint          x, start = -1, first;
+
+    /* columns older than the first sample stored, or than GAP_HISTORY, are never gaps */
+    first = MAX(cp -> w - (gint)MIN(chart -> stored, GAP_HISTORY), 0);
+
+    for(x = first; x <= cp -> w; ++x) {
+        if((x < cp -> w) && chart -> gaps[(chart -> stored - cp -> w + x) % GAP_HISTORY]) {
+            if(start < 0) start = x;
+        } else if(start >= 0) {
+            gdk_draw_drawable(cp -> pixmap, cp -> drawing_area -> style -> fg_gc[GTK_STATE_NORMAL],
+                              cp -> bg_pixmap, start, 0, start, 0, x - start, cp -> h);
+            start = -1;
+        }
+    }
+}
+
+
 /** Draw the chart data and, optionally, text overlay. 
  *  As the user can opt to have a text over on the charts, this function
- *  is required to handle the drawing. 
+ *  is required to handle the drawing. Hidden charts are not drawn at all 
+ *  (bups_show_chart() draws them when they come back) and the overlay text
+ *  is only formatted again when there is a new sample or format.
  */  
 /*  WARN: Safe for 1.0 and 2.0, with correct config structure changes. 
  */
 static void draw_chart(BUPSChart *chart)
 {
-    chart -> draw_buffer[0] = '\0';
+    if(chart -> hidden) return;
 
 	gkrellm_draw_chartdata(chart -> chart);
+    draw_gaps(chart);
     if(chart -> show_text) {
-        chart -> format(chart -> draw_buffer, DRAW_BUFFER_SIZE, chart -> text_format);
+        if(chart -> text_stale) {
+            format_render(chart -> compiled, chart -> status, chart -> draw_buffer, DRAW_BUFFER_SIZE);
+            chart -> text_stale = FALSE;
+        }
         gkrellm_draw_chart_text(chart -> chart, bups_style_id, chart -> draw_buffer);
     }
 	gkrellm_draw_chart_to_screen(chart -> chart);
+    chart -> dirty = FALSE;
+}
+
+
+/** Work out which message the scrolling log should show.
+ */
+static gchar *log_message(void)
+{
+    if(bups_data -> log_text) return bups_data -> log_text;
+
+    return bups_data -> status.ups_Present ? "No log messsage waiting." : "No UPS detected!";
+}
+
+
+/** Move the scrolling log message to a new position in the decal.
+ *  With GKrellM 2.2 or later this just copies the already rendered text
+ *  at the new offset, older versions have to draw the text again.
+ */
+static void move_log(gint x)
+{
+#ifdef BUPS_SCROLL_TEXT
+    gkrellm_decal_text_set_offset(bups_data -> log_decal, x, 0);
+#else
+    bups_data -> log_decal -> x_off = x;
+    gkrellm_draw_decal_text(bups_data -> log_display, bups_data -> log_decal, bups_data -> log_shown, x);
+#endif
 }
 
 
 /** Draw the log panel, either drawing a static label or a scrolling log.
  *  This function handles the drawing of the ups "log message" panel, either
  *  showing a static "UPS" label or scrolling the last log message from
- *  the UPS service.
+ *  the UPS service. The message is only rendered when it changes, after 
+ *  that scrolling just moves it one pixel along, and a message that fits
+ *  in the panel does not scroll at all.
+ *
+ *  \return TRUE if the panel has changed and needs drawing to the screen.
  */
 /*  WARN: Safe for 1.0 and 2.0, with correct config structure changes. 
  */
-static void draw_log(void)
+static gboolean draw_log(void)
 {
-    gint width;
+    gchar *message;
+    gint   width;
 
-    if(bups_data -> config -> show_log) {
-        /* This next bit is taken from gkrellweather - I much prefer this scrolling 
-         * setup to the more jumpy version used in some of the other panels
-         */
-        width = gkrellm_chart_width();
-        bups_data -> log_scr = (bups_data -> log_scr + 1) % (2 * width);
-        bups_data -> log_decal -> x_off = width - bups_data -> log_scr;
-        if(bups_data -> log_text) {
-            gkrellm_draw_decal_text(bups_data -> log_display, bups_data -> log_decal, bups_data -> log_text, width - bups_data -> log_scr);
-        } else {
-            /* FIXME!! locking?!? */
-            if(ups_status.ups_Present) {
-                gkrellm_draw_decal_text(bups_data -> log_display, bups_data -> log_decal, "No log messsage waiting.", width - bups_data -> log_scr);
-            } else {
-                gkrellm_draw_decal_text(bups_data -> log_display, bups_data -> log_decal, "No UPS detected!", width - bups_data -> log_scr);
-            }
-        }
-    } else {
+    if(!bups_data -> config -> show_log) {
         bups_data -> label_decal -> x_off = bups_data -> label_x;
         gkrellm_draw_decal_text(bups_data -> log_display, bups_data -> label_decal, bups_data -> log_label, -1);
+        return TRUE;
     }
+
+    width   = bups_data -> log_decal -> w;
+    message = log_message();
+    if(bups_data -> log_changed || (message != bups_data -> log_shown)) {
+        bups_data -> log_shown   = message;
+        bups_data -> log_changed = FALSE;
+        bups_data -> log_scr     = 0;
+#ifdef BUPS_SCROLL_TEXT
+        gkrellm_decal_scroll_text_set_text(bups_data -> log_display, bups_data -> log_decal, message);
+        gkrellm_decal_scroll_text_get_size(bups_data -> log_decal, &bups_data -> log_width, NULL);
+#else
+        bups_data -> log_width = gdk_string_width(bups_data -> log_decal -> text_style.font, message);
+#endif
+        if(bups_data -> log_width <= width) {
+            move_log(0);
+            return TRUE;
+        }
+    } else if(bups_data -> log_width <= width) {
+        return FALSE;
+    }
+
+    /* This next bit is taken from gkrellweather - I much prefer this scrolling 
+     * setup to the more jumpy version used in some of the other panels. The
+     * message scrolls in from the right until it has gone off the left.
+     */
+    bups_data -> log_scr = (bups_data -> log_scr + 1) % (width + bups_data -> log_width);
+    move_log(width - bups_data -> log_scr);
+    return TRUE;
 }
 
 
@@ -301,7 +412,9 @@ static gint expose_log_event(GtkWidget *widget, GdkEventExpose *event)
 /** Callback for handling button events sent to the charts.
  *  Pressing the right mouse button, or double-left-clicking will open the 
  *  chartcofig window for the chart the user has selected. Single-left 
- *  clicking toggles the chart text overlay function.
+ *  clicking toggles the chart text overlay function and middle clicking
+ *  steps the chart through live samples, minute and hour averages (only the
+ *  first endpoint has averages).
  */
 /*  NOTE: 2.0 safe only. 
  */
@@ -315,13 +428,19 @@ static void cb_chart_click(GtkWidget *widget, GdkEventButton *event, gpointer da
         target -> show_text = !target -> show_text;
         gkrellm_config_modified();
         draw_chart(target);
+    } else if((event -> button == 2) && (event -> type == GDK_BUTTON_PRESS) && !target -> endpoint) {
+        target -> resolution = (target -> resolution + 1) % ROLLUP_TIERS;
+        fill_chart(target);
+        gkrellm_config_modified();
+        draw_chart(target);
     }
 }
 
 
 /** Callback for handling button events sent to the log panel.
- *  A single right click will open the plugin configuration while lief-clicking
- *  toggles between the label and scrolling log displays.
+ *  A single right click will open the plugin configuration while middle-clicking
+ *  toggles between the label and scrolling log displays. Left clicking dumps
+ *  the instrumentation histograms (see stats.c) to stderr.
  */
 /*  WARN: Safe for 1.0 and 2.0, with correct config structure changes. 
  */
@@ -329,15 +448,19 @@ static void cb_log_click(GtkWidget *widget, GdkEventButton *event)
 {
 	if(event -> button == 3) {
 		gkrellm_open_config_window(bups_mon);
+	} else if((event -> button == 1) && (event -> type == GDK_BUTTON_PRESS)) {
+        stats_dump(stderr);
 	} else if(event -> button == 2) {
         if(bups_data -> config -> show_log) {
             gkrellm_make_decal_invisible(bups_data -> log_display, bups_data -> log_decal);
             bups_data -> config -> show_log = FALSE;
+            bups_data -> log_dirty = TRUE;
             draw_log();
             gkrellm_make_decal_visible(bups_data -> log_display, bups_data -> label_decal);
         } else {
             gkrellm_make_decal_invisible(bups_data -> log_display, bups_data -> label_decal);
             bups_data -> config -> show_log = TRUE;
+            bups_data -> log_changed = TRUE;
             draw_log();
             gkrellm_make_decal_visible(bups_data -> log_display, bups_data -> log_decal);
         }
@@ -346,71 +469,315 @@ static void cb_log_click(GtkWidget *widget, GdkEventButton *event)
 }
 
 
+/** Callback for the pointer entering the log panel.
+ *  The instrumentation summary is only rendered into the tooltip when it is 
+ *  about to be shown, not every tick.
+ */
+static gboolean cb_log_enter(GtkWidget *widget, GdkEventCrossing *event)
+{
+    GString *text = g_string_new("");
+
+    stats_summary(text);
+    gtk_tooltips_set_tip(bups_data -> tooltip, widget, text -> str, NULL);
+    g_string_free(text, TRUE);
+
+    return FALSE;
+}
+
+
 /*****************************************************************************\
 * Creation and update functions.                                              *
 \*****************************************************************************/ 
 
-/** Add latest chart values and check for log updates.
- *  Called fairly regularly, but this only does anythignn really interesting once
- *  a second - it locks the mutex on ups_status and updates all three charts to
- *  the latest values from the client thread. Once done the log string is 
- *  checked and possibly duplicated. 
- */ 
-/*  NOTE: 2.0 safe only, uses glib 2 mutex
+/** Chart any samples published since the last call and check for log updates.
+ *  The client thread has this called (see ups_notify()) as soon as it has
+ *  published a sample, so samples are charted straight away rather than on
+ *  the next second tick. Every sample queued by each endpoint is taken in
+ *  turn, so none are missed or charted twice however fast they arrive. The
+ *  first endpoint's samples are stored in all its visible charts, appended to
+ *  the history file and added to the rollups (charts showing minutes or hours
+ *  only move on when a rollup bucket is completed), the other endpoints' 
+ *  samples just go in their charts. The charts are drawn once all the 
+ *  samples are in, then the log string is copied from the latest published
+ *  sample (log messages are not queued) if the client has stamped it with a
+ *  new sequence number. Taking samples never waits on the client
+ *  thread, so a slow server can't hold up the GKrellM window.
+ */
+static void bups_update_samples(void)
+{
+    struct UPSData sample;
+    BUPSChart     *chart;
+    gboolean       fresh[MAX_ENDPOINTS];
+    gint           entry, endpoint;
+    gint           skipped[ROLLUP_TIERS];
+    guint          completed;
+    gint64         start = stats_now();
+
+    for(endpoint = 0; endpoint < MAX_ENDPOINTS; ++endpoint) fresh[endpoint] = FALSE;
+
+    while(ups_take_sample(0, &bups_data -> status)) {
+        store_sample(&bups_data -> status, NULL);
+        completed = rollup_add(&bups_data -> status, bups_data -> status.ups_Time, skipped);
+        store_rollups(completed, skipped);
+        history_append(&bups_data -> status);
+        fresh[0] = TRUE;
+    }
+
+    for(endpoint = 1; endpoint <= bups_data -> config -> endpoint_count; ++endpoint) {
+        while(ups_take_sample(endpoint, &sample)) {
+            for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+                chart = bups_data -> charts[entry];
+                if(chart -> endpoint != endpoint) continue;
+
+                memcpy(chart -> status, &sample, sizeof(struct UPSData));
+                store_chart(chart, chart -> status);
+            }
+            fresh[endpoint] = TRUE;
+        }
+    }
+
+    /* only charts with new data or a new sample for the overlay need drawing */
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        chart = bups_data -> charts[entry];
+        if(chart -> hidden) continue;
+
+        if(fresh[chart -> endpoint]) {
+            chart -> text_stale = TRUE;
+            chart -> dirty |= chart -> show_text;
+        }
+        if(chart -> dirty) draw_chart(chart);
+    }
+
+    /* the message is only copied when the client says it is a new one */
+    ups_read_status(0, &sample);
+    if(sample.log_Seq != bups_data -> log_seq) {
+        bups_data -> log_seq = sample.log_Seq;
+        if(sample.ups_LastLog[0] && gkrellm_dup_string(&bups_data -> log_text, sample.ups_LastLog)) {
+            bups_data -> log_changed = TRUE;
+        }
+    }
+
+    stats_since(STAT_UI_TICK, start);
+}
+
+
+/** Scroll the log and catch anything bups_update_samples() missed.
+ *  Called by GKrellM fairly regularly. Samples are charted when the client 
+ *  thread says they have arrived, the second tick only checks for any that
+ *  slipped through (bups_update_samples() does nothing if none are queued).
+ */
+/*  NOTE: 2.0 safe only
  */
 void bups_update_plugin(void)
 {
-    gint vala, valb, valc;
+    gint64 start;
+
+    /* timed separately, it is also called on its own */
+    if(GK.second_tick) bups_update_samples();
+    start = stats_now();
+
+    /* the static label only needs drawing when it changes, and the log only when it scrolls */
+    if(!bups_data -> log_hidden && (bups_data -> config -> show_log || bups_data -> log_dirty)) {
+        if(draw_log()) gkrellm_draw_panel_layers(bups_data -> log_display);
+        bups_data -> log_dirty = FALSE;
+    }
 
-    if(GK.second_tick) {
-        if(ups_status_lock) g_mutex_lock(ups_status_lock); /* best to do this even though we aren't writing */
-        vala = LIM_FLOOR((gint)ups_status.in_Voltage - bups_data -> config -> mains, 0);
-        valb = LIM_FLOOR((gint)ups_status.out_Voltage - bups_data -> config -> mains, 0);
-        valc = LIM_FLOOR((gint)ups_status.bat_Voltage, 0);
-        gkrellm_store_chartdata(bups_data -> volt_chart.chart, 0, vala, valb, valc);
-        draw_chart(&bups_data -> volt_chart);
+    stats_since(STAT_UI_TICK, start);
+}
 
-        vala = LIM_FLOOR((gint)ups_status.in_Freq, 0);
-        valb = LIM_FLOOR((gint)ups_status.out_Freq, 0);
-        gkrellm_store_chartdata(bups_data -> freq_chart.chart, 0, vala, valb);
-        draw_chart(&bups_data -> freq_chart);
 
-        vala = LIM_FLOOR((gint)ups_status.ups_Temp, 0);
-        valb = LIM_FLOOR((gint)ups_status.ups_Load, 0);
-        gkrellm_store_chartdata(bups_data -> temp_chart.chart, 0, vala, valb);
-        draw_chart(&bups_data -> temp_chart);
+/** Show or hide a chart.
+ *  Hidden charts keep storing samples (which costs next to nothing), only the
+ *  drawing is skipped, so one coming back into view just needs drawing.
+ */
+void bups_show_chart(BUPSChart *chart, gboolean show)
+{
+    chart -> hidden = !show;
 
-        /* this bit MUST be inside a mutex on ups_status or heaven knows what will happen when the 
-         * thread updates ups_LastLog half way through the strdup ... 
-         */
-        vala = strlen(ups_status.ups_LastLog);
-        if(vala) {
-            gkrellm_dup_string(&bups_data -> log_text, ups_status.ups_LastLog);
+    if(show) {
+        gkrellm_chart_show(chart -> chart, TRUE);
+        chart -> text_stale = TRUE;
+        draw_chart(chart);
+    } else {
+        gkrellm_chart_hide(chart -> chart, TRUE);
+    }
+}
+
+
+/** Show or hide the log panel.
+ */
+void bups_show_log(gboolean show)
+{
+    bups_data -> log_hidden = !show;
+
+    if(show) {
+        gkrellm_panel_show(bups_data -> log_display);
+        bups_data -> log_dirty = bups_data -> log_changed = TRUE;
+    } else {
+        gkrellm_panel_hide(bups_data -> log_display);
+    }
+}
+
+
+/** Set the text overlay format of a chart.
+ *  The format is compiled here, once, rather than being parsed every time
+ *  the overlay is drawn. Nothing happens if the format has not changed.
+ *
+ *  \par Arguments:
+ *  \arg \c chart - The chart to set the format of.
+ *  \arg \c format - The new format string.
+ */
+void bups_set_format(BUPSChart *chart, gchar *format)
+{
+    if(gkrellm_dup_string(&chart -> text_format, format) || !chart -> compiled) {
+        format_free(chart -> compiled);
+        chart -> compiled   = format_compile(chart -> text_format, chart -> codes);
+        chart -> text_stale = chart -> dirty = TRUE;
+    }
+}
+
+
+/*****************************************************************************\
+* Chart definitions.                                                          *
+\*****************************************************************************/ 
+
+/** Find a chart by the key its settings are saved under.
+ *
+ *  \return The chart, NULL if there is no chart with that key.
+ */
+BUPSChart *bups_find_chart(const gchar *key)
+{
+    gint entry;
+
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        if(!strcmp(bups_data -> charts[entry] -> key, key)) return bups_data -> charts[entry];
+    }
+
+    return NULL;
+}
+
+
+/** Define a chart, or redefine an existing one with the same key.
+ *  This only sets up the BUPSChart, the widgets are made by bups_create_plugin(),
+ *  so charts have to be defined before then (ie: from the config). Charts with
+ *  one of the chart_defaults[] keys get its $ codes and format popup, others 
+ *  only understand the long ${name} codes.
+ *
+ *  \par Arguments:
+ *  \arg \c key - Name the chart's settings are saved under.
+ *  \arg \c endpoint - Endpoint to plot, 0 is the server selected in the config.
+ *  \arg \c metrics - Comma separated format_metrics[] names of the values to plot.
+ *  \arg \c label - Text shown in the panel below the chart.
+ *  \return The chart, NULL if metrics didn't name any values.
+ */
+BUPSChart *bups_define_chart(const gchar *key, gint endpoint, const gchar *metrics, const gchar *label)
+{
+    BUPSChart   *chart = bups_find_chart(key);
+    const gchar *name  = metrics;
+    GString     *format;
+    gint         def, len, metric, count = 0, used[MAX_DATA];
+
+    while(*name && (count < MAX_DATA)) {
+        len = strcspn(name, ",");
+        if((metric = format_metric(name, len)) >= 0) {
+            used[count++] = metric;
+        } else {
+            fprintf(stderr, "bups_define_chart: chart %s has unknown value '%.*s'\n", key, len, name);
         }
-        if(ups_status_lock) g_mutex_unlock(ups_status_lock);
+        name += len;
+        if(*name == ',') ++name;
     }
-    draw_log();
-    gkrellm_draw_panel_layers(bups_data -> log_display);
+
+    if(!count || (chart && chart -> chart)) {
+        fprintf(stderr, "bups_define_chart: unable to define chart %s\n", key);
+        return NULL;
+    }
+
+    if(!chart) {
+        chart = g_new0(BUPSChart, 1);
+        chart -> key = g_strdup(key);
+        bups_data -> charts = g_renew(BUPSChart *, bups_data -> charts, bups_data -> chart_count + 1);
+        bups_data -> charts[bups_data -> chart_count++] = chart;
+    }
+
+    gkrellm_dup_string(&chart -> label, (gchar *)label);
+    memcpy(chart -> metrics, used, count * sizeof(gint));
+    chart -> metric_count = count;
+
+    if(chart -> endpoint) g_free(chart -> status);
+    chart -> endpoint = CLAMP(endpoint, 0, MAX_ENDPOINTS - 1);
+    chart -> status   = chart -> endpoint ? g_new0(struct UPSData, 1) : &bups_data -> status;
+
+    for(def = 0; chart_defaults[def].key && strcmp(chart_defaults[def].key, key); ++def);
+    chart -> codes   = chart_defaults[def].codes;
+    chart -> options = chart_defaults[def].options;
+
+    if(chart_defaults[def].format) {
+        bups_set_format(chart, chart_defaults[def].format);
+    } else {
+        /* something to show until the user picks a format */
+        format = g_string_new("");
+        for(metric = 0; metric < count; ++metric) {
+            g_string_append_printf(format, "%s${%s}", metric ? "\\n" : "", format_metrics[used[metric]].name);
+        }
+        bups_set_format(chart, format -> str);
+        g_string_free(format, TRUE);
+    }
+
+    return chart;
+}
+
+
+/** Define the standard voltage, frequency and temperature/load charts.
+ */
+void bups_default_charts(void)
+{
+    gint def;
+
+    for(def = 0; chart_defaults[def].key; ++def) {
+        bups_define_chart(chart_defaults[def].key, 0, chart_defaults[def].metrics, chart_defaults[def].label);
+    }
+}
+
+
+/** Remove every chart. Like bups_define_chart() this can only be done before
+ *  the widgets are made, the config uses it to replace the default charts.
+ */
+void bups_clear_charts(void)
+{
+    BUPSChart *chart;
+    gint       entry;
+
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        chart = bups_data -> charts[entry];
+        if(chart -> endpoint) g_free(chart -> status);
+        format_free(chart -> compiled);
+        g_free(chart -> text_format);
+        g_free(chart -> label);
+        g_free(chart -> key);
+        g_free(chart);
+    }
+
+    g_free(bups_data -> charts);
+    bups_data -> charts      = NULL;
+    bups_data -> chart_count = 0;
 }
 
 
-/** Create a new BUPSData chart.
+/** Create the widgets for a chart.
  *  Simple enough to describe - this creates charts. What it actually does is more
  *  complicated, but that is best highlighted via th arguments:
  *
  *  \par Arguments:
  *  \arg \c vbox - the box into which a vbox containing a chart and panel should be added.
- *  \arg \c data - the BUPSData structure to fill in.
+ *  \arg \c data - the BUPSChart to create, as set up by bups_define_chart().
  *  \arg \c firstCreate - TRUE when this is the first tiem this has been called.
- *  \arg \c dataNames - array of names, one for each chartdata element (last element should be NULL).
- *  \arg \c name - Text to display as a label in the panel below the chart.
- *  \arg \c format - pointer to the function which formats this charts text overlay.
  */
 /*  NOTE: 2.0 safe only, uses GTK 2 signal model 
  */
-static void create_chart(GtkWidget *vbox, BUPSChart *data, gint firstCreate, gchar *dataNames[], gchar *name, void (*format)(gchar *, gint, gchar*))
+static void create_chart(GtkWidget *vbox, BUPSChart *data, gint firstCreate)
 {
-    int count = 0;
+    int count;
  
     if(firstCreate) {
         /* Create a vbox into whcih the chart and panel can be added */
@@ -421,18 +788,17 @@ static void create_chart(GtkWidget *vbox, BUPSChart *data, gint firstCreate, gch
         /* Chart and panel creation... */
 		data -> chart = gkrellm_chart_new0();
         data -> panel = data -> chart -> panel = gkrellm_panel_new0();
-        data -> format = format;
     }
+    data -> text_stale = TRUE;
 
     gkrellm_set_chart_height_default(data -> chart, DEFAULT_CHARTHEIGHT);
     gkrellm_chart_create(data -> vbox, bups_mon, data -> chart, &data -> config);
 
-    while((count < MAX_DATA) && dataNames[count]) {
-        data -> data[count] = gkrellm_add_default_chartdata(data -> chart, dataNames[count]);
+    for(count = 0; count < data -> metric_count; ++count) {
+        data -> data[count] = gkrellm_add_default_chartdata(data -> chart, (gchar *)format_metrics[data -> metrics[count]].label);
         gkrellm_monotonic_chartdata(data -> data[count], FALSE);
         gkrellm_set_chartdata_draw_style_default(data -> data[count], CHARTDATA_LINE);
         gkrellm_set_chartdata_flags(data -> data[count], CHARTDATA_ALLOW_HIDE);
-        count ++;
     }
 
 	/* Set your own chart draw function if you have extra info to draw */
@@ -449,7 +815,7 @@ static void create_chart(GtkWidget *vbox, BUPSChart *data, gint firstCreate, gch
                                                    0, 0, 0, 70);
 	gkrellm_chartconfig_grid_resolution_label(data -> config, "Units drawn on the chart");
 
-    gkrellm_panel_configure(data -> panel, name, gkrellm_panel_style(bups_style_id));
+    gkrellm_panel_configure(data -> panel, data -> label, gkrellm_panel_style(bups_style_id));
     gkrellm_panel_create(data -> vbox, bups_mon, data -> panel);
 
 	gkrellm_alloc_chartdata(data -> chart);
@@ -477,17 +843,17 @@ static void create_chart(GtkWidget *vbox, BUPSChart *data, gint firstCreate, gch
 
 
 /** Create the plugin charts and panels. 
- *  Much of the actual work for this is done by the createChart() function, only 
+ *  Much of the actual work for this is done by the create_chart() function, only 
  *  the log display panel is actually created in teh body of this function - 
- *  createchart is called three times; once for the voltage display, once for 
- *  the frequency and once for the temperature. With a bit of fiddling it may
- *  be possible to make charts optional, but that's one for a future version..
+ *  create_chart is called once for each chart defined (by default the voltage,
+ *  frequency and temperature charts, see bups_default_charts()).
  */
 /*  NODE: 2.0 safe only, uses GTK 2 signal model. 
  */
 void bups_create_plugin(GtkWidget *vbox, gint firstCreate)
 {
-    gint labelWidth;
+    gint labelWidth, entry;
+    BUPSChart *chart;
 
     if(firstCreate) {
         bups_data -> vbox = gtk_vbox_new(FALSE, 0);
@@ -496,12 +862,17 @@ void bups_create_plugin(GtkWidget *vbox, gint firstCreate)
 
         bups_data -> log_display = gkrellm_panel_new0();
         bups_data -> log_label   = "UPS";
+        ups_notify(bups_update_samples);
         bups_data -> client     = launch_client(bups_data -> config);
+        if(history_open()) history_replay(HISTORY_RECORDS, seed_rollups, NULL);
     }
     
-    create_chart(bups_data -> vbox, &bups_data -> volt_chart, firstCreate, volt_names, "Voltages", format_volt_text);
-    create_chart(bups_data -> vbox, &bups_data -> freq_chart, firstCreate, freq_names, "Freq"    , format_freq_text);
-    create_chart(bups_data -> vbox, &bups_data -> temp_chart, firstCreate, temp_names, "Stats"   , format_temp_text);
+    /* the charts have just been (re)allocated empty, fill them back in from the history/rollups */
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        chart = bups_data -> charts[entry];
+        create_chart(bups_data -> vbox, chart, firstCreate);
+        fill_chart(chart);
+    }
 
 	bups_data -> log_style = gkrellm_meter_style(bups_style_id);
     bups_data -> log_decal = gkrellm_create_decal_text(bups_data -> log_display, "Afp0",
@@ -519,7 +890,8 @@ void bups_create_plugin(GtkWidget *vbox, gint firstCreate)
         bups_data -> label_x = 0;
     }
 
-    bups_data -> log_scr = 0;
+    bups_data -> log_scr     = 0;
+    bups_data -> log_changed = TRUE;   /* the decal is new, the message has to be rendered again */
 
 	gkrellm_panel_configure(bups_data -> log_display, NULL, bups_data -> log_style);
 	gkrellm_panel_create(vbox, bups_mon, bups_data -> log_display);
@@ -538,29 +910,10 @@ void bups_create_plugin(GtkWidget *vbox, gint firstCreate)
         gkrellm_make_decal_visible(bups_data -> log_display, bups_data -> label_decal);
     }
 
-        if(bups_data -> config -> show_volt) {
-            gkrellm_chart_show(bups_data -> volt_chart.chart, TRUE);
-        } else {
-            gkrellm_chart_hide(bups_data -> volt_chart.chart, TRUE);
-        }
-
-        if(bups_data -> config -> show_freq) {
-            gkrellm_chart_show(bups_data -> freq_chart.chart, TRUE);
-        } else {
-            gkrellm_chart_hide(bups_data -> freq_chart.chart, TRUE);
-        }
-
-        if(bups_data -> config -> show_stat) {
-            gkrellm_chart_show(bups_data -> temp_chart.chart, TRUE);
-        } else {
-            gkrellm_chart_hide(bups_data -> temp_chart.chart, TRUE);
-        }
-
-        if(bups_data -> config -> show_msgs) {
-            gkrellm_panel_show(bups_data -> log_display);
-        } else {
-            gkrellm_panel_hide(bups_data -> log_display);
-        }
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        bups_show_chart(bups_data -> charts[entry], !bups_data -> charts[entry] -> hidden);
+    }
+    bups_show_log(bups_data -> config -> show_msgs);
 
     if(firstCreate) {
  		g_signal_connect(G_OBJECT(bups_data -> log_display -> drawing_area), 
@@ -569,5 +922,9 @@ void bups_create_plugin(GtkWidget *vbox, gint firstCreate)
 		g_signal_connect(G_OBJECT(bups_data -> log_display -> drawing_area),
                          "button_press_event", 
                          G_CALLBACK(cb_log_click), NULL);
+		g_signal_connect(G_OBJECT(bups_data -> log_display -> drawing_area),
+                         "enter_notify_event", 
+                         G_CALLBACK(cb_log_enter), NULL);
+        bups_data -> tooltip = gtk_tooltips_new();
     }
 }
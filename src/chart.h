@@ -16,6 +16,8 @@
  *  \file chart.h
  *  This file contains the functions exported by chart.c and the BUPSChart
  *  structure that has to be visible to ups_connect.h and prefs.c.
+ *  Charts are defined as data, each one names the values it plots, so any
+ *  number of them (for any of the endpoints) can be set up in the config.
  */
 /*  $Id: chart.h,v 1.2 2003/02/06 21:07:53 chris Exp $
  */
@@ -28,17 +30,31 @@
 #endif
 
 #include<glib.h>
+#include"format.h"
 
-#define MAX_DATA  3 /*!< Maximum number of chartdata entries per chart */
+#define MAX_DATA  8 /*!< Maximum number of chartdata entries per chart, enough for all of format_metrics[] */
 
 #define DRAW_BUFFER_SIZE     64             /*!< length of temporary store buffer for the drawing code.    */
+#define GAP_HISTORY          1024           /*!< Samples per chart remembered as gaps or not, wider than any chart. */
+#define GAP_SILENCE          60000          /*!< Milliseconds between samples that are charted as a gap.   */
+
+struct UPSData;
 
 /*! Structure containing data related to a single chart object.
  *  This structure contains pointers to the various elements which together form
- *  a single chart in the GKrellM window (chart, config, panel etc).
+ *  a single chart in the GKrellM window (chart, config, panel etc), and the 
+ *  definition of what the chart plots. Charts are created by bups_define_chart().
  */
-typedef struct
+typedef struct _BUPSChart BUPSChart;
+struct _BUPSChart
 {
+    gchar              *key;            /*!< Name the chart's settings are saved under. */
+    gchar              *label;          /*!< Text shown in the panel below the chart. */
+    gint                endpoint;       /*!< Endpoint plotted, 0 is the server selected in the config. */
+    gint                metrics[MAX_DATA]; /*!< format_metrics[] indices of the values plotted. */
+    gint                metric_count;   /*!< Number of valid entries in metrics. */
+    gchar             **options;        /*!< Formats listed in the format popup, NULL for none. */
+    struct UPSData     *status;         /*!< Last sample for the endpoint, shown in the text overlay. */
     GtkWidget          *vbox;           /*!< Box into which the Chart and then Panel are added. */
     GkrellmChart       *chart;          /*!< The chart contained in vbox. */
     GkrellmChartdata   *data[MAX_DATA]; /*!< The data shown in the chart. */
@@ -48,11 +64,28 @@ typedef struct
     gboolean            show_text;      /*!< True if the chart text overlay should be drawn. */
     char               *text_format;    /*!< Text overlay format for this chart. */
     gchar               draw_buffer[DRAW_BUFFER_SIZE];
-    void              (*format)(gchar *, gint, gchar *); /*!< Text formatting function */
-} BUPSChart;
+    const BUPSFormatCode *codes;        /*!< Single character $ codes understood in text_format, may be NULL. */
+    BUPSFormat         *compiled;       /*!< text_format compiled by format_compile(). */
+    gint                resolution;     /*!< ROLLUP_SECOND for live samples, or the rollup tier plotted. */
+    gboolean            hidden;         /*!< TRUE if the user has hidden the chart, it is not drawn at all. */
+    gboolean            dirty;          /*!< TRUE if the chart has changed since it was last drawn. */
+    gboolean            text_stale;     /*!< TRUE if draw_buffer needs formatting again (new sample or format). */
+    guchar              gaps[GAP_HISTORY]; /*!< TRUE for the samples stored as gaps, indexed by stored % GAP_HISTORY. */
+    guint               stored;         /*!< Samples stored since the chart was last reset. */
+    gint                last[MAX_DATA]; /*!< Values of the last valid sample, stored again for a gap. */
+    gint64              stamp;          /*!< UPSData.ups_Stamp of the last sample stored, 0 if not known. */
+    gint64              time;           /*!< UPSData.ups_Time of the last sample stored, 0 if not known. */
+};
 
 
 extern void bups_create_plugin(GtkWidget *vbox, gint firstCreate);
 extern void bups_update_plugin(void);
+extern void bups_show_chart(BUPSChart *chart, gboolean show);
+extern void bups_show_log(gboolean show);
+extern void bups_set_format(BUPSChart *chart, gchar *format);
+extern BUPSChart *bups_define_chart(const gchar *key, gint endpoint, const gchar *metrics, const gchar *label);
+extern BUPSChart *bups_find_chart(const gchar *key);
+extern void bups_default_charts(void);
+extern void bups_clear_charts(void);
 
 #endif /* #ifndef _CHART_H */
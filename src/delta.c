@@ -0,0 +1,182 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file delta.c
+ *  Compact encoding of UPSData updates sent from gkrellmd to GKrellM.
+ *  The server plugin only sends what has changed since the last update, as
+ *  lines of text (which is what the gkrellmd plugin channel carries):
+ *
+ * <PRE>
+ * d f<n>=<tenths> p=<0|1> a=<0|1> c=<count> v<n>=<value> ...
+ * l <seq> <message>
+ * </PRE>
+ *
+ *  f<n> is the n'th float in UPSData (bat_Voltage is 0, ups_Temp is 7) in
+ *  tenths, p is ups_Present, a is ups_Valid (servers that don't send it 
+ *  leave it following p), c is val_Count and v<n> is val_Fields[n]. Only 
+ *  the fields that have changed appear on a "d" line, and the "l" line is
+ *  only sent when the log message changes. A client that has just connected
+ *  is sent everything.
+ */
+/*  $Id: delta.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<string.h>
+#include<stdlib.h>
+#include"delta.h"
+
+/*! Offsets of the floats in UPSData, in the order they are numbered on the wire. */
+static const glong float_offsets[] =
+{
+    G_STRUCT_OFFSET(struct UPSData, bat_Voltage),
+    G_STRUCT_OFFSET(struct UPSData, bat_Level),
+    G_STRUCT_OFFSET(struct UPSData, in_Freq),
+    G_STRUCT_OFFSET(struct UPSData, in_Voltage),
+    G_STRUCT_OFFSET(struct UPSData, out_Freq),
+    G_STRUCT_OFFSET(struct UPSData, out_Voltage),
+    G_STRUCT_OFFSET(struct UPSData, ups_Load),
+    G_STRUCT_OFFSET(struct UPSData, ups_Temp),
+};
+
+#define FLOAT_COUNT  (sizeof(float_offsets) / sizeof(float_offsets[0]))
+
+/** Convert float number n of a sample into tenths. 
+ */
+static gint float_tenths(struct UPSData *sample, gint n)
+{
+    gfloat value = *(gfloat *)((gchar *)sample + float_offsets[n]);
+
+    return (gint)((value * 10.0) + ((value < 0) ? -0.5 : 0.5));
+}
+
+
+/** Encode the changes between the last sample sent and a new one.
+ *  Each field is only written if it differs from sent (or full is set), 
+ *  then sent is updated to match the sample.
+ *
+ *  \par Arguments:
+ *  \arg \c sent - The last sample sent, updated to sample.
+ *  \arg \c sample - The sample to send.
+ *  \arg \c full - Send every field, for a client that has just connected.
+ *  \arg \c buffer - Buffer to write the update lines into, DELTA_BUFSIZE is enough.
+ *  \arg \c size - Size of buffer.
+ *  \return The length of the update, 0 if nothing has changed.
+ */
+gint delta_encode(struct UPSData *sent, struct UPSData *sample, gboolean full, gchar *buffer, gint size)
+{
+    gint used = 0, start, field, value;
+
+    /* "d" and a space per field, any line without fields is dropped again */
+    used += g_snprintf(buffer + used, size - used, "d");
+    start = used;
+
+    for(field = 0; (field < FLOAT_COUNT) && (used < size); ++field) {
+        value = float_tenths(sample, field);
+        if(full || (value != float_tenths(sent, field))) {
+            used += g_snprintf(buffer + used, size - used, " f%d=%d", field, value);
+        }
+    }
+
+    if((full || (sample -> ups_Present != sent -> ups_Present)) && (used < size)) {
+        used += g_snprintf(buffer + used, size - used, " p=%d", sample -> ups_Present ? 1 : 0);
+    }
+
+    /* always after p, which sets it too */
+    if((full || (sample -> ups_Present != sent -> ups_Present) || (sample -> ups_Valid != sent -> ups_Valid)) && (used < size)) {
+        used += g_snprintf(buffer + used, size - used, " a=%d", sample -> ups_Valid ? 1 : 0);
+    }
+
+    if((full || (sample -> val_Count != sent -> val_Count)) && (used < size)) {
+        used += g_snprintf(buffer + used, size - used, " c=%d", sample -> val_Count);
+    }
+
+    for(field = 0; (field < sample -> val_Count) && (used < size); ++field) {
+        if(full || (field >= sent -> val_Count) || (sample -> val_Fields[field] != sent -> val_Fields[field])) {
+            used += g_snprintf(buffer + used, size - used, " v%d=%d", field, sample -> val_Fields[field]);
+        }
+    }
+
+    if(used == start) {
+        used = 0;
+    } else if(used < size) {
+        used += g_snprintf(buffer + used, size - used, "\n");
+    }
+
+    if((full || (sample -> log_Seq != sent -> log_Seq)) && (used < size)) {
+        used += g_snprintf(buffer + used, size - used, "l %u %s\n", sample -> log_Seq, sample -> ups_LastLog);
+    }
+
+    memcpy(sent, sample, sizeof(struct UPSData));
+    buffer[MIN(used, size - 1)] = '\0';
+
+    return MIN(used, size - 1);
+}
+
+
+/** Apply an update line from delta_encode() to a sample.
+ *
+ *  \par Arguments:
+ *  \arg \c dest - The sample to update.
+ *  \arg \c line - A single line of the update, with or without the newline.
+ *  \return TRUE if the line was understood.
+ */
+gboolean delta_decode(struct UPSData *dest, const gchar *line)
+{
+    const gchar *pos;
+    gchar       *end;
+    gint         field, len;
+    glong        value;
+
+    if(!strncmp(line, "l ", 2)) {
+        dest -> log_Seq = strtoul(line + 2, &end, 10);
+        if(*end == ' ') ++end;
+
+        len = strcspn(end, "\r\n");
+        len = MIN(len, MAX_LOGSIZE - 1);
+        memcpy(dest -> ups_LastLog, end, len);
+        dest -> ups_LastLog[len] = '\0';
+        return TRUE;
+    }
+
+    if(*line != 'd') return FALSE;
+
+    for(pos = line + 1; *pos == ' '; ) {
+        ++pos;
+        field = (pos[1] == '=') ? 0 : strtol(pos + 1, &end, 10);
+        end   = strchr(pos, '=');
+        if(!end) return FALSE;
+        value = strtol(end + 1, &end, 10);
+
+        switch(*pos) {
+            case 'f': if((field >= 0) && (field < FLOAT_COUNT)) {
+                          *(gfloat *)((gchar *)dest + float_offsets[field]) = value / 10.0;
+                      }
+                      break;
+            case 'p': dest -> ups_Present = dest -> ups_Valid = (value != 0);
+                      break;
+            case 'a': dest -> ups_Valid = (value != 0);
+                      break;
+            case 'c': dest -> val_Count = CLAMP(value, 0, MAX_VALFIELDS);
+                      break;
+            case 'v': if((field >= 0) && (field < MAX_VALFIELDS)) dest -> val_Fields[field] = value;
+                      break;
+            default:  break;  /* something a newer server knows about */
+        }
+        pos = end;
+    }
+
+    return TRUE;
+}
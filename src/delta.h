@@ -0,0 +1,35 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file delta.h
+ *  Functions exported by delta.c, used by both the GKrellM plugin and the
+ *  gkrellmd server plugin.
+ */
+/*  $Id: delta.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _DELTA_H
+#define _DELTA_H 1
+
+#include<glib.h>
+#include"ups_connect.h"
+
+#define SERVE_NAME     "gkrellmbups"  /*!< Name the server plugin serves data under.         */
+#define DELTA_BUFSIZE  2048           /*!< Room for the longest update delta_encode() writes. */
+
+extern gint     delta_encode(struct UPSData *sent, struct UPSData *sample, gboolean full, gchar *buffer, gint size);
+extern gboolean delta_decode(struct UPSData *dest, const gchar *line);
+
+#endif /* #ifndef _DELTA_H */
@@ -0,0 +1,283 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file format.c
+ *  Chart text overlay formats.
+ *  The text format for each chart is compiled once, when it is loaded or 
+ *  changed, into a short list of operations - literal spans of the format 
+ *  string and references to the values to print - so drawing the overlay 
+ *  every second is just a few copies and number conversions.
+ *
+ *  Values can be given either with the single character "$" codes shown in
+ *  the help (which mean different things on different charts, $i is input 
+ *  voltage on the voltage chart but input frequency on the frequency chart) 
+ *  or with the long ${name} codes, which work on any chart. ${valN} prints
+ *  field N of the last Belkin VAL record.
+ */
+/*  $Id: format.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<string.h>
+#include<stdlib.h>
+#include"format.h"
+
+/*! Long names for the UPSData values, the charts use these too. */
+const BUPSMetric format_metrics[] =
+{
+    { "in_volt",   "Input voltage",    G_STRUCT_OFFSET(struct UPSData, in_Voltage),  TRUE  },
+    { "out_volt",  "Output voltage",   G_STRUCT_OFFSET(struct UPSData, out_Voltage), TRUE  },
+    { "bat_volt",  "Battery voltage",  G_STRUCT_OFFSET(struct UPSData, bat_Voltage), FALSE },
+    { "bat_level", "Battery level",    G_STRUCT_OFFSET(struct UPSData, bat_Level),   FALSE },
+    { "in_freq",   "Input frequency",  G_STRUCT_OFFSET(struct UPSData, in_Freq),     FALSE },
+    { "out_freq",  "Output frequency", G_STRUCT_OFFSET(struct UPSData, out_Freq),    FALSE },
+    { "load",      "Load",             G_STRUCT_OFFSET(struct UPSData, ups_Load),    FALSE },
+    { "temp",      "Temperature",      G_STRUCT_OFFSET(struct UPSData, ups_Temp),    FALSE },
+    { NULL, NULL, -1, FALSE }
+};
+
+/*! Voltage chart codes. */
+const BUPSFormatCode format_volt_codes[] = { { 'i', "in_volt" }, { 'o', "out_volt" }, { 'b', "bat_volt" }, { 'l', "bat_level" }, { 0, NULL } };
+
+/*! Frequency chart codes. */
+const BUPSFormatCode format_freq_codes[] = { { 'i', "in_freq" }, { 'o', "out_freq" }, { 0, NULL } };
+
+/*! Temperature/load chart codes. */
+const BUPSFormatCode format_temp_codes[] = { { 't', "temp" }, { 'l', "load" }, { 0, NULL } };
+
+
+/** Find a value in format_metrics[] by name.
+ *
+ *  \par Arguments:
+ *  \arg \c name - Start of the name.
+ *  \arg \c len - Length of the name, -1 if it is nul terminated.
+ *  \return The format_metrics[] index of the value, -1 if there is no such value.
+ */
+gint format_metric(const gchar *name, gint len)
+{
+    gint metric;
+
+    if(len < 0) len = strlen(name);
+
+    for(metric = 0; format_metrics[metric].name; ++metric) {
+        if((strlen(format_metrics[metric].name) == len) && !strncmp(name, format_metrics[metric].name, len)) {
+            return metric;
+        }
+    }
+
+    return -1;
+}
+
+
+/** Check whether a flag is one of the space separated flags in a NUT status.
+ *
+ *  \par Arguments:
+ *  \arg \c status - The status string, may be NULL.
+ *  \arg \c flag - The flag to look for, e.g. "OB".
+ *  \return TRUE if the flag is set.
+ */
+gboolean format_has_flag(const gchar *status, const gchar *flag)
+{
+    gint len = strlen(flag), span;
+
+    while(status && *status) {
+        while(*status == ' ') ++status;
+        span = strcspn(status, " ");
+        if((span == len) && !strncmp(status, flag, len)) return TRUE;
+        status += span;
+    }
+
+    return FALSE;
+}
+
+
+/** Work out what a long code name refers to.
+ *
+ *  \par Arguments:
+ *  \arg \c name - Start of the name.
+ *  \arg \c len - Length of the name.
+ *  \arg \c op - Filled in with the operation to print the value.
+ *  \return TRUE if the name was recognised.
+ */
+static gboolean lookup_name(const gchar *name, gint len, BUPSFormatOp *op)
+{
+    gint  metric;
+    gchar *end;
+
+    if((metric = format_metric(name, len)) >= 0) {
+        op -> type = FORMAT_METRIC;
+        op -> arg  = format_metrics[metric].offset;
+        return TRUE;
+    }
+
+    if((len > 3) && !strncmp(name, "val", 3)) {
+        op -> arg = strtol(name + 3, &end, 10);
+        if((end == name + len) && (op -> arg >= 0) && (op -> arg < MAX_VALFIELDS)) {
+            op -> type = FORMAT_VAL;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+/** Compile a chart text format.
+ *  Anything that isn't a recognised $ or ${} code is copied as it is, 
+ *  neighbouring bits of literal text end up in a single span.
+ *
+ *  \par Arguments:
+ *  \arg \c source - The format string, may be NULL.
+ *  \arg \c codes - Single character codes for the chart the format is for.
+ *  \return The compiled format (free with format_free()), NULL if source is NULL.
+ */
+BUPSFormat *format_compile(const gchar *source, const BUPSFormatCode *codes)
+{
+    BUPSFormat   *format;
+    BUPSFormatOp  op;
+    const gchar  *pos, *name, *close;
+    gint          code, used;
+
+    if(source == NULL) return NULL;
+
+    format = g_new0(BUPSFormat, 1);
+    format -> source = g_strdup(source);
+    format -> ops    = g_new0(BUPSFormatOp, strlen(source) + 1);  /* can't be more ops than characters */
+
+    for(pos = format -> source; *pos; pos += used) {
+        used = 0;
+
+        if(*pos == '$') {
+            if(pos[1] == '{') {
+                name = pos + 2;
+                if(((close = strchr(name, '}')) != NULL) && lookup_name(name, close - name, &op)) {
+                    used = close + 1 - pos;
+                }
+            } else if(pos[1]) {
+                for(code = 0; codes && codes[code].code; ++code) {
+                    if((codes[code].code == pos[1]) && lookup_name(codes[code].name, strlen(codes[code].name), &op)) {
+                        used = 2;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if(used) {
+            format -> ops[format -> count++] = op;
+        } else {
+            /* literal, extend the last span if there is one */
+            used = 1;
+            if(format -> count && (format -> ops[format -> count - 1].type == FORMAT_LITERAL)) {
+                format -> ops[format -> count - 1].len++;
+            } else {
+                format -> ops[format -> count].type = FORMAT_LITERAL;
+                format -> ops[format -> count].arg  = pos - format -> source;
+                format -> ops[format -> count].len  = 1;
+                format -> count++;
+            }
+        }
+    }
+
+    return format;
+}
+
+
+/** Free a format returned by format_compile(), NULL is ignored.
+ */
+void format_free(BUPSFormat *format)
+{
+    if(format) {
+        g_free(format -> source);
+        g_free(format -> ops);
+        g_free(format);
+    }
+}
+
+
+/** Write a number of tenths as "units.tenth" (like %3.1f would).
+ *
+ *  \return The number of characters written to text, which must have room for 14.
+ */
+static gint print_tenths(gchar *text, gint tenths)
+{
+    gchar    digits[12];
+    gint     count = 0, len = 0;
+    guint    value;
+
+    if(tenths < 0) {
+        text[len++] = '-';
+        value = 0U - (guint)tenths;
+    } else {
+        value = tenths;
+    }
+
+    do {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while(value || (count < 2));
+
+    while(count > 1) text[len++] = digits[--count];
+    text[len++] = '.';
+    text[len++] = digits[0];
+
+    return len;
+}
+
+
+/** Render a compiled format with the values from a sample.
+ *  Output is truncated to fit the buffer and always terminated.
+ *
+ *  \par Arguments:
+ *  \arg \c format - The compiled format, NULL gives "No format".
+ *  \arg \c status - Sample to take the values from.
+ *  \arg \c buffer - Destination buffer.
+ *  \arg \c size - Size of buffer.
+ */
+void format_render(BUPSFormat *format, struct UPSData *status, gchar *buffer, gint size)
+{
+    BUPSFormatOp *op, *end;
+    gchar         number[16];
+    const gchar  *text;
+    gint          len, used = 0;
+    gfloat        value;
+
+    if(format == NULL) {
+        g_snprintf(buffer, size, "No format");
+        return;
+    }
+
+    size--;
+    end = format -> ops + format -> count;
+    for(op = format -> ops; (op < end) && (used < size); ++op) {
+        switch(op -> type) {
+            case FORMAT_METRIC: value = *(gfloat *)((gchar *)status + op -> arg);
+                                len   = print_tenths(number, (gint)((value * 10.0) + ((value < 0) ? -0.5 : 0.5)));
+                                text  = number;
+                                break;
+            case FORMAT_VAL:    len   = print_tenths(number, (op -> arg < status -> val_Count) ? status -> val_Fields[op -> arg] : 0);
+                                text  = number;
+                                break;
+            default:            len   = op -> len;
+                                text  = format -> source + op -> arg;
+                                break;
+        }
+
+        len = MIN(len, size - used);
+        memcpy(buffer + used, text, len);
+        used += len;
+    }
+    buffer[used] = '\0';
+}
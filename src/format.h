@@ -0,0 +1,75 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file format.h
+ *  Functions exported by format.c and the compiled chart text format.
+ */
+/*  $Id: format.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _FORMAT_H
+#define _FORMAT_H 1
+
+#include<glib.h>
+#include"ups_connect.h"
+
+#define FORMAT_LITERAL  0  /*!< Copy a span of the format string.                   */
+#define FORMAT_METRIC   1  /*!< Print a UPSData float, arg is its offset.          */
+#define FORMAT_VAL      2  /*!< Print a raw Belkin VAL field, arg is the field number. */
+
+/*! Single character "$" code, and the long name it stands for on a chart. */
+typedef struct
+{
+    gchar        code;               /*!< The character after the $.                  */
+    const gchar *name;               /*!< Long (${name}) form of the code.            */
+} BUPSFormatCode;
+
+/*! A UPSData value that can be shown in a format or plotted on a chart. */
+typedef struct
+{
+    const gchar *name;               /*!< Long (${name}) code, also used in chart definitions. */
+    const gchar *label;              /*!< Name of the value in the chart config window. */
+    glong        offset;             /*!< Offset of the gfloat in struct UPSData.     */
+    gboolean     mains;              /*!< TRUE for mains voltages, charted less the mains offset. */
+} BUPSMetric;
+
+/*! A single step of a compiled format. */
+typedef struct
+{
+    gint         type;               /*!< One of the FORMAT_* values above.           */
+    glong        arg;                /*!< Start of a literal span, metric offset or VAL field. */
+    gint         len;                /*!< Length of a literal span.                   */
+} BUPSFormatOp;
+
+/*! A chart text format compiled by format_compile(). */
+typedef struct
+{
+    gchar        *source;            /*!< Copy of the format string, literal spans point into it. */
+    BUPSFormatOp *ops;               /*!< The steps to render the format.            */
+    gint          count;             /*!< Number of entries in ops.                   */
+} BUPSFormat;
+
+extern const BUPSMetric     format_metrics[];
+extern const BUPSFormatCode format_volt_codes[];
+extern const BUPSFormatCode format_freq_codes[];
+extern const BUPSFormatCode format_temp_codes[];
+
+extern gint        format_metric (const gchar *name, gint len);
+extern gboolean    format_has_flag(const gchar *status, const gchar *flag);
+extern BUPSFormat *format_compile(const gchar *source, const BUPSFormatCode *codes);
+extern void        format_free   (BUPSFormat *format);
+extern void        format_render (BUPSFormat *format, struct UPSData *status, gchar *buffer, gint size);
+
+#endif /* #ifndef _FORMAT_H */
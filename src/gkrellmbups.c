@@ -21,6 +21,7 @@
  */
 
 #include "gkrellmbups.h"
+#include "delta.h"
 
 GKrellMBUPS    *bups_data;
 GkrellmMonitor *bups_mon;
@@ -60,9 +61,17 @@ GkrellmMonitor *gkrellm_init_plugin(void)
     bups_data = g_new0(GKrellMBUPS, 1);
     bups_data -> config = bups_create_config();
 
+    /* the config is loaded before the charts are created, it can add to or replace these */
+    bups_default_charts();
+
 	bups_style_id = gkrellm_add_chart_style(&mon, STYLE_NAME);
 	bups_mon = &mon;
 
+#ifdef BUPS_SERVE_DATA
+    /* only used in MODE_GKRELLMD, when gkrellmd_bups.so is polling the UPS for us */
+    gkrellm_client_plugin_serve_data_connect(&mon, SERVE_NAME, ups_serve_input);
+#endif
+
     fprintf(stderr, "gkrellm_init_plugin: initalising 2.0.2\n");
 
 	return bups_mon;
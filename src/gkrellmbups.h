@@ -33,6 +33,7 @@
 #include<glib.h>
 #include"chart.h"
 #include"prefs.h"
+#include"ups_connect.h"
 #include"../config.h"
 
 #define CONFIG_NAME             "GKrellMBUPS"  /*!< Name for the configuration tab.    */
@@ -40,6 +41,16 @@
 #define STYLE_NAME              "gkrellmbups"  /*!< style name to allow custom themes. */
 #define INSERT_BEFORE           MON_FS         /*!< Insert plugin before this monitor. */
 
+/* GKrellM 2.2 can render scrolling decal text once and move it by offset,
+ * and lets client plugins take data from their gkrellmd server plugin.
+ */
+#ifdef GKRELLM_CHECK_VERSION
+#if GKRELLM_CHECK_VERSION(2,2,0)
+#define BUPS_SCROLL_TEXT        1
+#define BUPS_SERVE_DATA         1
+#endif
+#endif
+
 /*! Central data store structure.
  *  This contains pointers to all the UPSChart structures and various gkrellm 
  *  objects used by the plugin.
@@ -47,17 +58,24 @@
 typedef struct
 {
     BUPSConfig   *config;       /*!< Configuration data.                                         */
-    BUPSChart     volt_chart;   /*!< Input and output and battery voltage display.               */
-    BUPSChart     freq_chart;   /*!< Input and output frequency chart.                           */
-    BUPSChart     temp_chart;   /*!< Temperature and load chart (fixed max is 100).              */
+    struct UPSData status;      /*!< Snapshot of the last sample published by the client thread. */
+    BUPSChart   **charts;       /*!< The charts, in the order they are shown.                    */
+    gint          chart_count;  /*!< Number of valid entries in charts.                          */
     GkrellmPanel *log_display;  /*!< Panel on which a decal can scroll the last UPS log message. */
     GkrellmStyle *log_style;    /*!< Style data for the loag display panel.                      */
     GkrellmDecal *log_decal;    /*!< Decal used on logDisplay.                                   */
     gchar        *log_label;    /*!< Text displayed when the log display is deactivated          */
     gchar        *log_text;     /*!< Text displayed when the log display is activated            */
     gint          log_scr;      /*!< Horizontal scroll                                           */
+    guint         log_seq;      /*!< UPSData.log_Seq of log_text.                                */
+    gchar        *log_shown;    /*!< Message currently rendered into log_decal.                  */
+    gint          log_width;    /*!< Width of log_shown in pixels.                               */
+    gboolean      log_changed;  /*!< TRUE if log_text has changed since it was rendered.         */
+    gboolean      log_hidden;   /*!< TRUE if the log panel is hidden, it is not drawn at all.    */
+    gboolean      log_dirty;    /*!< TRUE if the static label needs drawing again.               */
     GkrellmDecal *label_decal;  /*!< Decal used on logDisplay.                                   */
     gint          label_x;      /*!< Horizontal position of the label                            */
+    GtkTooltips  *tooltip;      /*!< Instrumentation summary shown over the log panel.           */
     GtkWidget    *vbox;
     GThread      *client;       /*!< FIXME: 1.0 safe only, fix for 2.0                           */
 } GKrellMBUPS;
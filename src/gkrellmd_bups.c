@@ -0,0 +1,157 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file gkrellmd_bups.c
+ *  gkrellmd server plugin.
+ *  When a lot of GKrellMs are watching the same UPS, it is much kinder to
+ *  upsd (or the Belkin server) to poll it once from gkrellmd and pass the 
+ *  results on to the GKrellMs connected to it. This runs the same client
+ *  thread as the GKrellM plugin (ups_connect.c) and serves the changes to 
+ *  each sample, encoded by delta.c, to any GKrellM running the plugin in
+ *  MODE_GKRELLMD.
+ *
+ *  The UPS to poll is set in gkrellmd.conf with the same mode, pro_net, 
+ *  belkin_host, belkin_port, nut_host, nut_port, connect_timeout, 
+ *  metrics_listen and alert lines used in the GKrellM user config.
+ */
+/*  $Id: gkrellmd_bups.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<gkrellm2/gkrellmd.h>
+#include<stdlib.h>
+#include<string.h>
+#include"ups_connect.h"
+#include"delta.h"
+
+static BUPSConfig     config;                  /*!< UPS settings from gkrellmd.conf.                 */
+static GThread       *client;                  /*!< The client thread polling the UPS.               */
+static guint          generation;              /*!< Generation of the last sample encoded.          */
+static struct UPSData sent;                    /*!< The last sample sent to the GKrellMs.           */
+static gchar          update[DELTA_BUFSIZE];   /*!< Changes to send with the next serve_data call.  */
+
+
+/** Read the UPS settings from gkrellmd.conf.
+ */
+static void load_config(GkrellmdMonitor *mon)
+{
+    const gchar *line;
+    gchar        keyword[31], data[CONFIG_BUFSIZE];
+
+    config.mode            = DEFAULT_MODE;
+    config.pro_net         = g_strdup(DEFAULT_PRONET);
+    config.belkin_host     = g_strdup(DEFAULT_BELKIN_HOST);
+    config.belkin_port     = DEFAULT_BELKIN_PORT;
+    config.nut_host        = g_strdup(DEFAULT_NUT_HOST);
+    config.nut_port        = DEFAULT_NUT_PORT;
+    config.connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+
+    while((line = gkrellmd_config_getline(mon)) != NULL) {
+        if(2 != sscanf(line, "%30s %255[^\n]", keyword, data)) continue;
+
+        if(!strcmp(keyword, "mode")) {
+            config.mode = strtol(data, NULL, 10);
+        } else if(!strcmp(keyword, "pronet") || !strcmp(keyword, "pro_net")) {
+            g_free(config.pro_net);
+            config.pro_net = g_strdup(data);
+        } else if(!strcmp(keyword, "belkin_host")) {
+            g_free(config.belkin_host);
+            config.belkin_host = g_strdup(data);
+        } else if(!strcmp(keyword, "belkin_port")) {
+            config.belkin_port = strtol(data, NULL, 10);
+        } else if(!strcmp(keyword, "nut_host")) {
+            g_free(config.nut_host);
+            config.nut_host = g_strdup(data);
+        } else if(!strcmp(keyword, "nut_port")) {
+            config.nut_port = strtol(data, NULL, 10);
+        } else if(!strcmp(keyword, "connect_timeout")) {
+            config.connect_timeout = strtol(data, NULL, 10);
+        } else if(!strcmp(keyword, "metrics_listen")) {
+            g_free(config.metrics_listen);
+            config.metrics_listen = g_strdup(data);
+        } else if(!strcmp(keyword, "alert")) {
+            if(config.alert_count < MAX_ALERTS) config.alerts[config.alert_count++] = g_strdup(data);
+        } else {
+            fprintf(stderr, "gkrellmd_bups: unknown config keyword '%s'\n", keyword);
+        }
+    }
+
+    /* we are the gkrellmd, we can't ask one for the data */
+    if(config.mode == MODE_GKRELLMD) config.mode = DEFAULT_MODE;
+}
+
+
+/** Check for a new sample and work out what has changed in it.
+ *  The changes are kept until gkrellmd calls serve_data(), which then sends the
+ *  same update to every GKrellM connected.
+ */
+static void update_ups(GkrellmdMonitor *mon, gboolean first_update)
+{
+    struct UPSData sample;
+    guint          latest;
+
+    /* anything from the last update has already been served */
+    update[0] = '\0';
+    if(!first_update && !gkrellmd_ticks() -> second_tick) return;
+
+    latest = ups_read_status(0, &sample);
+    if(latest == generation) return;
+    generation = latest;
+
+    if(delta_encode(&sent, &sample, FALSE, update, DELTA_BUFSIZE)) {
+        gkrellmd_need_serve(mon);
+    }
+}
+
+
+/** Send the latest changes, or everything to a GKrellM that has just connected.
+ */
+static void serve_ups(GkrellmdMonitor *mon, gboolean first_serve)
+{
+    struct UPSData empty;
+    gchar          full[DELTA_BUFSIZE];
+
+    if(first_serve) {
+        memset(&empty, 0, sizeof(struct UPSData));
+        delta_encode(&empty, &sent, TRUE, full, DELTA_BUFSIZE);
+        gkrellmd_serve_data(mon, full);
+    } else if(update[0]) {
+        gkrellmd_serve_data(mon, update);
+    }
+}
+
+
+/** gkrellmd Monitor structure for the server plugin.
+ */
+static GkrellmdMonitor mon =
+{
+    SERVE_NAME,     /*!< Name, used for the gkrellmd.conf section too  */
+    update_ups,     /*!< update_monitor()                             */
+    serve_ups,      /*!< serve_data()                                 */
+    NULL            /*!< serve_setup(), there is nothing to set up    */
+};
+
+
+/** Server plugin initialisation function.
+ */
+GkrellmdMonitor *gkrellmd_init_plugin(void)
+{
+    gkrellmd_set_serve_name(&mon, SERVE_NAME);
+    load_config(&mon);
+
+    client = launch_client(&config);
+    if(!client) fprintf(stderr, "gkrellmd_bups: unable to start the UPS client thread\n");
+
+    return &mon;
+}
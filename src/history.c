@@ -0,0 +1,208 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file history.c
+ *  Persistent sample history.
+ *  Every sample shown on the charts is also appended to a ring of fixed size
+ *  records in a memory mapped file in the gkrellm data directory, so the 
+ *  charts can be filled straight back in when GKrellM is restarted (after a
+ *  power cut, say, which is exactly when you want to see what happened).
+ *
+ *  Appending is just a 64 byte store into the mapping - the kernel writes 
+ *  the pages back in its own time, there are no system calls once the file
+ *  is open.
+ */
+/*  $Id: history.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<stdio.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include"gkrellmbups.h"
+#include"history.h"
+
+/*! Size of the whole history file. */
+#define HISTORY_SIZE (sizeof(BUPSHistoryHeader) + (HISTORY_RECORDS * sizeof(BUPSHistoryRecord)))
+
+static BUPSHistoryHeader *header  = NULL; /*!< Start of the mapping, NULL if there is no history file. */
+static BUPSHistoryRecord *records = NULL; /*!< The ring, immediately after the header.                */
+static guint32            next    = 1;    /*!< Sequence number of the next record appended.           */
+
+
+/** Work out the checksum for a record.
+ *  Nothing clever, just enough to tell a complete record from a torn one.
+ */
+static guint32 record_check(BUPSHistoryRecord *record)
+{
+    guint32 *word = (guint32 *)record;
+    guint32  sum  = 0x42555053;
+    guint    count;
+
+    /* skip seq and check themselves */
+    for(count = 2; count < (sizeof(BUPSHistoryRecord) / sizeof(guint32)); ++count) {
+        sum = ((sum << 5) | (sum >> 27)) ^ word[count];
+    }
+
+    return sum ^ record -> seq;
+}
+
+
+/** Open (creating if needed) and map the history file.
+ *  A file with the wrong magic or size is started again from scratch. The 
+ *  record with the highest valid sequence number is the newest, appending 
+ *  carries on after it.
+ *
+ *  \return TRUE if the history is available.
+ */
+gboolean history_open(void)
+{
+    gchar      *dirname, *filename;
+    struct stat info;
+    gint        fd, slot;
+    gboolean    fresh;
+
+    if(header) return TRUE;
+
+    dirname  = g_strdup_printf("%s/%s", gkrellm_homedir(), GKRELLM_DATA_DIR);
+    filename = g_strdup_printf("%s/%s", dirname, HISTORY_FILE);
+    mkdir(dirname, 0755);
+
+    if((fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0) {
+        fprintf(stderr, "history_open: unable to open %s: %s\n", filename, strerror(errno));
+        g_free(dirname);
+        g_free(filename);
+        return FALSE;
+    }
+    g_free(dirname);
+    g_free(filename);
+
+    fresh = (fstat(fd, &info) < 0) || (info.st_size != HISTORY_SIZE);
+    if(fresh && (ftruncate(fd, 0) < 0 || ftruncate(fd, HISTORY_SIZE) < 0)) {
+        fprintf(stderr, "history_open: unable to size history file: %s\n", strerror(errno));
+        close(fd);
+        return FALSE;
+    }
+
+    header = mmap(NULL, HISTORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED) {
+        fprintf(stderr, "history_open: unable to map history file: %s\n", strerror(errno));
+        header = NULL;
+        return FALSE;
+    }
+    records = (BUPSHistoryRecord *)(header + 1);
+
+    if(fresh || memcmp(header -> magic, HISTORY_MAGIC, sizeof(header -> magic)) ||
+       (header -> record_size != sizeof(BUPSHistoryRecord)) || (header -> records != HISTORY_RECORDS)) {
+        memset(header, 0, HISTORY_SIZE);
+        memcpy(header -> magic, HISTORY_MAGIC, sizeof(header -> magic));
+        header -> record_size = sizeof(BUPSHistoryRecord);
+        header -> records     = HISTORY_RECORDS;
+    }
+
+    next = 1;
+    for(slot = 0; slot < HISTORY_RECORDS; ++slot) {
+        if(records[slot].seq && (records[slot].seq >= next) && (records[slot].check == record_check(&records[slot]))) {
+            next = records[slot].seq + 1;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/** Append a sample to the history.
+ *  The record is filled in with its sequence number cleared and only marked
+ *  valid once everything else is in place.
+ */
+void history_append(struct UPSData *sample)
+{
+    BUPSHistoryRecord *record;
+
+    if(!header) return;
+
+    record = &records[next % HISTORY_RECORDS];
+    record -> seq         = 0;
+    record -> time        = sample -> ups_Time ? sample -> ups_Time : time(NULL);
+    record -> bat_Voltage = sample -> bat_Voltage;
+    record -> bat_Level   = sample -> bat_Level;
+    record -> in_Freq     = sample -> in_Freq;
+    record -> in_Voltage  = sample -> in_Voltage;
+    record -> out_Freq    = sample -> out_Freq;
+    record -> out_Voltage = sample -> out_Voltage;
+    record -> ups_Load    = sample -> ups_Load;
+    record -> ups_Temp    = sample -> ups_Temp;
+    record -> ups_Present = sample -> ups_Present;
+    record -> ups_Valid   = sample -> ups_Valid;
+    record -> check       = record_check(record) ^ next; /* as if seq were already set */
+
+    /* make sure the compiler doesn't move the seq store before the rest */
+    __asm__ __volatile__("" ::: "memory");
+    record -> seq = next++;
+}
+
+
+/** Replay the most recent samples from the history, oldest first.
+ *  Only an unbroken run of valid records is replayed, stopping at the first 
+ *  gap or torn record going back from the newest.
+ *
+ *  \par Arguments:
+ *  \arg \c count - Maximum number of samples to replay.
+ *  \arg \c store - Function called for each sample.
+ *  \arg \c data - Passed to store.
+ *  \return The number of samples replayed.
+ */
+gint history_replay(gint count, void (*store)(struct UPSData *, gpointer), gpointer data)
+{
+    BUPSHistoryRecord *record;
+    struct UPSData     sample;
+    guint32            seq, first;
+
+    if(!header || (next == 1)) return 0;
+
+    count = MIN(count, HISTORY_RECORDS);
+
+    /* walk back from the newest record to find where the run starts */
+    for(first = next; (first > 1) && ((gint)(next - first) < count); --first) {
+        record = &records[(first - 1) % HISTORY_RECORDS];
+        if((record -> seq != first - 1) || (record -> check != record_check(record))) break;
+    }
+
+    memset(&sample, 0, sizeof(sample));
+    for(seq = first; seq < next; ++seq) {
+        record = &records[seq % HISTORY_RECORDS];
+        sample.bat_Voltage = record -> bat_Voltage;
+        sample.bat_Level   = record -> bat_Level;
+        sample.in_Freq     = record -> in_Freq;
+        sample.in_Voltage  = record -> in_Voltage;
+        sample.out_Freq    = record -> out_Freq;
+        sample.out_Voltage = record -> out_Voltage;
+        sample.ups_Load    = record -> ups_Load;
+        sample.ups_Temp    = record -> ups_Temp;
+        sample.ups_Present = record -> ups_Present;
+        sample.ups_Valid   = record -> ups_Valid;
+        sample.ups_Time    = record -> time;
+        store(&sample, data);
+    }
+
+    return next - first;
+}
@@ -0,0 +1,71 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file history.h
+ *  Functions exported by history.c and the layout of the history file.
+ */
+/*  $Id: history.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _HISTORY_H
+#define _HISTORY_H 1
+
+#include<glib.h>
+#include"ups_connect.h"
+
+#define HISTORY_FILE     "gkrellmbups.history" /*!< Name of the history file in the gkrellm data directory. */
+#define HISTORY_MAGIC    "BUPSHIS2"            /*!< First 8 bytes of a history file, changes with the layout. */
+#define HISTORY_RECORDS  3600                  /*!< Samples kept, an hour at one a second.                    */
+
+/*! History file header.
+ *  Written once when the file is created and never touched again, so there is
+ *  nothing in it that a crash can leave half written. Where the ring starts
+ *  and ends is worked out from the record sequence numbers instead.
+ */
+typedef struct
+{
+    gchar   magic[8];                /*!< HISTORY_MAGIC.                              */
+    guint32 record_size;             /*!< sizeof(BUPSHistoryRecord).                  */
+    guint32 records;                 /*!< Number of records in the ring.              */
+    gchar   reserved[48];            /*!< Pads the header out to one record.          */
+} BUPSHistoryHeader;
+
+/*! A single sample in the history file, exactly one 64 byte cache line.
+ *  The sequence number is written last and check covers the rest of the
+ *  record, so a record torn by a crash part way through is spotted and ignored.
+ */
+typedef struct
+{
+    guint32 seq;                     /*!< Sample number (from 1), 0 if the slot has never been used. */
+    guint32 check;                   /*!< Checksum of the record, see record_check() in history.c.   */
+    gint64  time;                    /*!< Wall clock time of the sample (seconds since the epoch).   */
+    gfloat  bat_Voltage;             /*!< Battery voltage.                            */
+    gfloat  bat_Level;               /*!< Battery level.                              */
+    gfloat  in_Freq;                 /*!< Input frequency.                            */
+    gfloat  in_Voltage;              /*!< Input voltage.                              */
+    gfloat  out_Freq;                /*!< Output frequency.                           */
+    gfloat  out_Voltage;             /*!< Output voltage.                             */
+    gfloat  ups_Load;                /*!< Load level.                                 */
+    gfloat  ups_Temp;                /*!< Temperature.                                */
+    guint32 ups_Present;             /*!< UPSData.ups_Present.                        */
+    guint32 ups_Valid;               /*!< UPSData.ups_Valid, 0 for a gap in the history. */
+    gchar   reserved[8];             /*!< Pads the record out to 64 bytes.            */
+} BUPSHistoryRecord;
+
+extern gboolean history_open  (void);
+extern void     history_append(struct UPSData *sample);
+extern gint     history_replay(gint count, void (*store)(struct UPSData *, gpointer), gpointer data);
+
+#endif /* #ifndef _HISTORY_H */
@@ -0,0 +1,536 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file metrics.c
+ *  OpenMetrics (Prometheus) exposition of the UPS data.
+ *  If a "metrics_listen" address is set in the config, the client thread 
+ *  listens on it and answers every HTTP request with the latest values of
+ *  all the endpoints it monitors, so Prometheus can scrape the UPS without 
+ *  another exporter polling the UPS server. The address is either a unix
+ *  socket path (starting with /) or a TCP port, optionally "address:port",
+ *  which defaults to listening on localhost only.
+ *
+ *  Everything here runs in the client thread's event loop, never on the GTK
+ *  thread, and a scrape never touches the UPS server. The whole response is
+ *  rendered at most once per sample (when the first scrape after a new sample
+ *  comes in). Each scraper gets its own copy, sent as fast as its socket 
+ *  will take it, so a big response or a slow scraper never blocks the loop.
+ */
+/*  $Id: metrics.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<poll.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include"metrics.h"
+#include"format.h"
+
+#define REQUEST_SIZE  1024  /*!< Longest request we wait for the end of.  */
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL  0     /*!< A scraper going away must not SIGPIPE GKrellM, where we can help it. */
+#endif
+
+/*! A scrape in progress, waiting for the request or sending the response. */
+typedef struct
+{
+    gint    fd;                       /*!< Accepted socket, -1 if the slot is free.    */
+    gint64  deadline;                 /*!< Monotonic time (ms) the scraper has until.  */
+    gint    rlen;                     /*!< Bytes of request received.                  */
+    gchar   request[REQUEST_SIZE];    /*!< Request received so far.                    */
+    gchar  *reply;                    /*!< Copy of the response being sent, NULL while reading the request. */
+    gsize   reply_len;                /*!< Length of reply.                            */
+    gsize   sent;                     /*!< Bytes of reply sent so far.                 */
+} MetricsConn;
+
+static gint         listener = -1;    /*!< Listening socket, -1 if metrics are off.    */
+static gchar       *unix_path;        /*!< Path of the unix socket, to remove on close. */
+static MetricsConn  conns[METRICS_MAX_CONNS];
+static GString     *response;         /*!< Rendered response, headers and all.         */
+
+/*! Connection states, in the same order as the STATE_* values in ups_connect.c. */
+const gchar *metrics_states[] = { "idle", "connecting", "connected", "failed", "resolving", NULL };
+
+/*! Upper bounds (seconds) of the latency histogram buckets. */
+static const gdouble bucket_bounds[METRICS_BUCKETS] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5 };
+
+/*! bucket_bounds[] as they appear in the le labels, plus +Inf, so rendering doesn't depend on the locale. */
+static const gchar *bucket_labels[METRICS_BUCKETS + 1] = { "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", 
+                                                           "0.25", "0.5", "1.0", "2.5", "+Inf" };
+
+/*! NUT status flags exposed as a state set. */
+static const gchar *status_flags[] = { "OL", "OB", "LB", "HB", "RB", "CHRG", "DISCHRG", "BYPASS", 
+                                       "CAL", "OFF", "OVER", "TRIM", "BOOST", "FSD", NULL };
+
+/*! UPSData values exposed as gauges. */
+static struct
+{
+    const gchar *name;
+    const gchar *unit;
+    const gchar *help;
+    glong        offset;
+} gauges[] =
+{
+    { "gkrellmbups_input_voltage_volts",     "volts",   "Utility input voltage.",          G_STRUCT_OFFSET(struct UPSData, in_Voltage)  },
+    { "gkrellmbups_output_voltage_volts",    "volts",   "Voltage supplied by the UPS.",    G_STRUCT_OFFSET(struct UPSData, out_Voltage) },
+    { "gkrellmbups_battery_voltage_volts",   "volts",   "Battery voltage.",                G_STRUCT_OFFSET(struct UPSData, bat_Voltage) },
+    { "gkrellmbups_battery_level_percent",   "percent", "Battery charge.",                 G_STRUCT_OFFSET(struct UPSData, bat_Level)   },
+    { "gkrellmbups_input_frequency_hertz",   "hertz",   "Utility input frequency.",        G_STRUCT_OFFSET(struct UPSData, in_Freq)     },
+    { "gkrellmbups_output_frequency_hertz",  "hertz",   "Frequency supplied by the UPS.",  G_STRUCT_OFFSET(struct UPSData, out_Freq)    },
+    { "gkrellmbups_load_percent",            "percent", "Load as a percentage of maximum.", G_STRUCT_OFFSET(struct UPSData, ups_Load)   },
+    { "gkrellmbups_temperature_celsius",     "celsius", "UPS internal temperature.",       G_STRUCT_OFFSET(struct UPSData, ups_Temp)    },
+    { NULL, NULL, NULL, -1 }
+};
+
+
+/*****************************************************************************\
+* Listener and connection handling.                                           *
+\*****************************************************************************/ 
+
+/** Drop a scrape, finished or not.
+ */
+static void metrics_drop(MetricsConn *conn)
+{
+    close(conn -> fd);
+    conn -> fd = -1;
+    g_free(conn -> reply);
+    conn -> reply = NULL;
+}
+
+
+/** Start listening for scrapes.
+ *
+ *  \par Arguments:
+ *  \arg \c address - Unix socket path, "port" or "address:port". NULL or
+ *                    empty leaves metrics off.
+ *  \return TRUE if metrics are on.
+ */
+gboolean metrics_open(const gchar *address)
+{
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    struct stat        st;
+    const gchar       *colon;
+    gint               slot, one = 1;
+
+    metrics_close();
+    if(!address || !*address) return FALSE;
+
+    for(slot = 0; slot < METRICS_MAX_CONNS; ++slot) conns[slot].fd = -1;
+
+    if(*address == '/') {
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        g_strlcpy(un.sun_path, address, sizeof(un.sun_path));
+
+        /* a socket left by an earlier run is replaced, anything else is a typo */
+        if(lstat(address, &st) == 0) {
+            if(!S_ISSOCK(st.st_mode)) {
+                fprintf(stderr, "metrics_open: %s exists and is not a socket\n", address);
+                return FALSE;
+            }
+            unlink(address);
+        }
+
+        if(((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) ||
+           (bind(listener, (struct sockaddr *)&un, sizeof(un)) < 0)) {
+            perror("metrics_open: unable to create unix socket");
+            metrics_close();
+            return FALSE;
+        }
+        unix_path = g_strdup(address);
+    } else {
+        memset(&in, 0, sizeof(in));
+        in.sin_family      = AF_INET;
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if((colon = strrchr(address, ':')) != NULL) {
+            gchar *host = g_strndup(address, colon - address);
+
+            if(!inet_aton(host, &in.sin_addr)) {
+                fprintf(stderr, "metrics_open: bad listen address '%s'\n", host);
+                g_free(host);
+                metrics_close();
+                return FALSE;
+            }
+            g_free(host);
+            address = colon + 1;
+        }
+        in.sin_port = htons(atoi(address));
+
+        if(((listener = socket(AF_INET, SOCK_STREAM, 0)) < 0) ||
+           (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) ||
+           (bind(listener, (struct sockaddr *)&in, sizeof(in)) < 0)) {
+            perror("metrics_open: unable to create metrics socket");
+            metrics_close();
+            return FALSE;
+        }
+    }
+
+    if(listen(listener, METRICS_MAX_CONNS) < 0) {
+        perror("metrics_open: unable to listen");
+        metrics_close();
+        return FALSE;
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+
+    return TRUE;
+}
+
+
+/** Stop listening and drop any scrapes in progress.
+ */
+void metrics_close(void)
+{
+    gint slot;
+
+    if(listener >= 0) {
+        close(listener);
+        for(slot = 0; slot < METRICS_MAX_CONNS; ++slot) {
+            if(conns[slot].fd >= 0) metrics_drop(&conns[slot]);
+        }
+    }
+    listener = -1;
+
+    if(unix_path) {
+        unlink(unix_path);
+        g_free(unix_path);
+        unix_path = NULL;
+    }
+}
+
+
+/** Fill in the pollfd entries for the listener and the scrapes in progress.
+ *  Scrapers that have not sent their request or taken the response in time
+ *  are dropped here.
+ *
+ *  \par Arguments:
+ *  \arg \c fds - Room for METRICS_MAX_CONNS + 1 entries.
+ *  \arg \c now - Monotonic time in milliseconds.
+ *  \arg \c timeout - poll() timeout, reduced if a scrape will time out sooner.
+ *  \return The number of entries filled in.
+ */
+gint metrics_pollfds(struct pollfd *fds, gint64 now, gint *timeout)
+{
+    gint slot, count = 0, wait;
+
+    if(listener < 0) return 0;
+
+    fds[count].fd       = listener;
+    fds[count].events   = POLLIN;
+    fds[count++].revents = 0;
+
+    for(slot = 0; slot < METRICS_MAX_CONNS; ++slot) {
+        if(conns[slot].fd < 0) continue;
+
+        if(conns[slot].deadline <= now) {
+            metrics_drop(&conns[slot]);
+            continue;
+        }
+
+        wait     = (gint)(conns[slot].deadline - now);
+        *timeout = (*timeout < 0) ? wait : MIN(*timeout, wait);
+
+        fds[count].fd       = conns[slot].fd;
+        fds[count].events   = conns[slot].reply ? POLLOUT : POLLIN;
+        fds[count++].revents = 0;
+    }
+
+    return count;
+}
+
+
+/** Check whether any of the metrics pollfds has something to do.
+ *  The client thread uses this to bring the response up to date before
+ *  calling metrics_io().
+ */
+gboolean metrics_waiting(struct pollfd *fds, gint count)
+{
+    gint entry;
+
+    for(entry = 0; entry < count; ++entry) {
+        if(fds[entry].revents) return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/** Accept a new scrape.
+ *
+ *  \par Arguments:
+ *  \arg \c now - Monotonic time in milliseconds.
+ */
+static void metrics_accept(gint64 now)
+{
+    gint fd, slot;
+
+    while((fd = accept(listener, NULL, NULL)) >= 0) {
+        for(slot = 0; (slot < METRICS_MAX_CONNS) && (conns[slot].fd >= 0); ++slot);
+
+        if(slot == METRICS_MAX_CONNS) {
+            /* too many at once, something is wrong with the scraper */
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        conns[slot].fd       = fd;
+        conns[slot].deadline = now + METRICS_TIMEOUT;
+        conns[slot].rlen     = 0;
+        conns[slot].reply    = NULL;
+    }
+}
+
+
+/** Send as much of the response as the socket will take.
+ *  The scrape is dropped once it has all been sent, or the scraper has gone.
+ */
+static void metrics_send(MetricsConn *conn)
+{
+    gssize put;
+
+    while(conn -> sent < conn -> reply_len) {
+        put = send(conn -> fd, conn -> reply + conn -> sent, conn -> reply_len - conn -> sent, MSG_NOSIGNAL);
+        if(put < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN) return;
+            break;
+        }
+        conn -> sent += put;
+    }
+
+    metrics_drop(conn);
+}
+
+
+/** Handle activity on the listener or a scrape.
+ *  Once the whole request header has arrived the scrape takes a copy of the
+ *  response (a new sample may change it before it has all gone) and sends 
+ *  it as the socket has room, closing the connection at the end. Whatever 
+ *  was asked for, the metrics are what you get.
+ *
+ *  \par Arguments:
+ *  \arg \c fd - The socket poll() reported.
+ *  \arg \c revents - What poll() reported.
+ */
+void metrics_io(gint fd, gshort revents)
+{
+    MetricsConn *conn = NULL;
+    gint         slot, got;
+
+    if(fd == listener) {
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        metrics_accept(((gint64)now.tv_sec * 1000) + (now.tv_nsec / 1000000));
+        return;
+    }
+
+    for(slot = 0; slot < METRICS_MAX_CONNS; ++slot) {
+        if(conns[slot].fd == fd) conn = &conns[slot];
+    }
+    if(!conn) return;
+
+    if(conn -> reply) {
+        metrics_send(conn);
+        return;
+    }
+
+    got = read(fd, conn -> request + conn -> rlen, REQUEST_SIZE - 1 - conn -> rlen);
+    if((got < 0) && ((errno == EAGAIN) || (errno == EINTR))) return;
+
+    if(got > 0) {
+        conn -> rlen += got;
+        conn -> request[conn -> rlen] = '\0';
+
+        /* wait for the end of the request header, unless it is silly big */
+        if(!strstr(conn -> request, "\r\n\r\n") && !strstr(conn -> request, "\n\n") && 
+           (conn -> rlen < REQUEST_SIZE - 1)) {
+            return;
+        }
+
+        if(response) {
+            conn -> reply     = g_memdup(response -> str, response -> len);
+            conn -> reply_len = response -> len;
+            conn -> sent      = 0;
+            metrics_send(conn);
+            return;
+        }
+    }
+
+    metrics_drop(conn);
+}
+
+
+/*****************************************************************************\
+* Rendering.                                                                  *
+\*****************************************************************************/ 
+
+/** Append a label value to the response body, quoted and escaped.
+ *  Endpoint names come straight from the host names in the config, so 
+ *  backslash, double quote and newline are escaped as OpenMetrics requires.
+ */
+static void append_label_value(GString *body, const gchar *value)
+{
+    g_string_append_c(body, '"');
+    for(; *value; ++value) {
+        switch(*value) {
+            case '\\': g_string_append(body, "\\\\"); break;
+            case '"':  g_string_append(body, "\\\""); break;
+            case '\n': g_string_append(body, "\\n"); break;
+            default:   g_string_append_c(body, *value); break;
+        }
+    }
+    g_string_append_c(body, '"');
+}
+
+
+/** Append an endpoint label set to the response body.
+ */
+static void append_labels(GString *body, BUPSMetricsEndpoint *endpoint, const gchar *name, const gchar *value)
+{
+    g_string_append(body, "{endpoint=");
+    append_label_value(body, endpoint -> name);
+    if(name) {
+        g_string_append_printf(body, ",%s=", name);
+        append_label_value(body, value);
+    }
+    g_string_append(body, "}");
+}
+
+
+/** Append a value and newline to the response body.
+ *  GKrellM has set LC_NUMERIC from the environment, which may well use a 
+ *  decimal comma, so the value is formatted with g_ascii_formatd().
+ */
+static void append_value(GString *body, const gchar *format, gdouble value)
+{
+    gchar text[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_string_append_printf(body, " %s\n", g_ascii_formatd(text, sizeof(text), format, value));
+}
+
+
+/** Render the response from the state of every endpoint.
+ *  The client thread calls this when a scrape arrives after a new sample,
+ *  the result is reused by every scrape until the next one.
+ *
+ *  \par Arguments:
+ *  \arg \c endpoints - The endpoints to describe.
+ *  \arg \c count - Number of entries in endpoints.
+ */
+void metrics_render(BUPSMetricsEndpoint *endpoints, gint count)
+{
+    GString *body = g_string_sized_new(8192);
+    gint     metric, endpoint, entry;
+    guint64  cumulative;
+
+    for(metric = 0; gauges[metric].name; ++metric) {
+        g_string_append_printf(body, "# TYPE %s gauge\n# UNIT %s %s\n# HELP %s %s\n", gauges[metric].name, 
+                               gauges[metric].name, gauges[metric].unit, gauges[metric].name, gauges[metric].help);
+        for(endpoint = 0; endpoint < count; ++endpoint) {
+            g_string_append(body, gauges[metric].name);
+            append_labels(body, &endpoints[endpoint], NULL, NULL);
+            append_value(body, "%.1f", *(gfloat *)((gchar *)endpoints[endpoint].sample + gauges[metric].offset));
+        }
+    }
+
+    g_string_append(body, "# TYPE gkrellmbups_present gauge\n# HELP gkrellmbups_present 1 if the UPS is connected to its server.\n");
+    for(endpoint = 0; endpoint < count; ++endpoint) {
+        g_string_append(body, "gkrellmbups_present");
+        append_labels(body, &endpoints[endpoint], NULL, NULL);
+        g_string_append_printf(body, " %d\n", endpoints[endpoint].sample -> ups_Present ? 1 : 0);
+    }
+
+    g_string_append(body, "# TYPE gkrellmbups_samples counter\n# HELP gkrellmbups_samples Samples published by the client.\n");
+    for(endpoint = 0; endpoint < count; ++endpoint) {
+        g_string_append(body, "gkrellmbups_samples_total");
+        append_labels(body, &endpoints[endpoint], NULL, NULL);
+        g_string_append_printf(body, " %u\n", endpoints[endpoint].samples);
+    }
+
+    g_string_append(body, "# TYPE gkrellmbups_connection stateset\n# HELP gkrellmbups_connection State of the connection to the UPS server.\n");
+    for(endpoint = 0; endpoint < count; ++endpoint) {
+        for(entry = 0; metrics_states[entry]; ++entry) {
+            g_string_append(body, "gkrellmbups_connection");
+            append_labels(body, &endpoints[endpoint], "gkrellmbups_connection", metrics_states[entry]);
+            g_string_append_printf(body, " %d\n", endpoints[endpoint].state == metrics_states[entry]);
+        }
+    }
+
+    g_string_append(body, "# TYPE gkrellmbups_status stateset\n# HELP gkrellmbups_status UPS status flags reported by NUT.\n");
+    for(endpoint = 0; endpoint < count; ++endpoint) {
+        if(!endpoints[endpoint].status) continue;
+        for(entry = 0; status_flags[entry]; ++entry) {
+            g_string_append(body, "gkrellmbups_status");
+            append_labels(body, &endpoints[endpoint], "gkrellmbups_status", status_flags[entry]);
+            g_string_append_printf(body, " %d\n", format_has_flag(endpoints[endpoint].status, status_flags[entry]));
+        }
+    }
+
+    g_string_append(body, "# TYPE gkrellmbups_poll_latency_seconds histogram\n# UNIT gkrellmbups_poll_latency_seconds seconds\n"
+                          "# HELP gkrellmbups_poll_latency_seconds Time taken by the UPS server to answer a poll.\n");
+    for(endpoint = 0; endpoint < count; ++endpoint) {
+        if(!endpoints[endpoint].latency) continue;
+
+        for(entry = 0, cumulative = 0; entry <= METRICS_BUCKETS; ++entry) {
+            cumulative += endpoints[endpoint].latency -> buckets[entry];
+            g_string_append(body, "gkrellmbups_poll_latency_seconds_bucket");
+            append_labels(body, &endpoints[endpoint], "le", bucket_labels[entry]);
+            g_string_append_printf(body, " %" G_GUINT64_FORMAT "\n", cumulative);
+        }
+        g_string_append(body, "gkrellmbups_poll_latency_seconds_count");
+        append_labels(body, &endpoints[endpoint], NULL, NULL);
+        g_string_append_printf(body, " %" G_GUINT64_FORMAT "\n", endpoints[endpoint].latency -> count);
+        g_string_append(body, "gkrellmbups_poll_latency_seconds_sum");
+        append_labels(body, &endpoints[endpoint], NULL, NULL);
+        append_value(body, "%.3f", endpoints[endpoint].latency -> sum);
+    }
+    g_string_append(body, "# EOF\n");
+
+    if(!response) response = g_string_sized_new(body -> len + 256);
+    g_string_printf(response, "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                              "Content-Length: %lu\r\n"
+                              "Connection: close\r\n\r\n", (gulong)body -> len);
+    g_string_append_len(response, body -> str, body -> len);
+    g_string_free(body, TRUE);
+}
+
+
+/** Add a poll round trip time to a latency histogram.
+ */
+void metrics_observe(BUPSLatency *latency, gint64 ms)
+{
+    gint bucket;
+
+    for(bucket = 0; (bucket < METRICS_BUCKETS) && ((ms / 1000.0) > bucket_bounds[bucket]); ++bucket);
+
+    latency -> buckets[bucket]++;
+    latency -> count++;
+    latency -> sum += ms / 1000.0;
+}
@@ -0,0 +1,63 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file metrics.h
+ *  Functions exported by metrics.c and the structures the client thread 
+ *  describes its endpoints with.
+ */
+/*  $Id: metrics.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H 1
+
+#include<glib.h>
+#include<poll.h>
+#include"ups_connect.h"
+
+#define METRICS_BUCKETS    11  /*!< Latency histogram buckets, not counting +Inf.           */
+#define METRICS_MAX_CONNS  8   /*!< Scrapes that can be in progress at once.                */
+#define METRICS_TIMEOUT    5000 /*!< Milliseconds a scraper gets to send its request and take the response. */
+
+/*! Histogram of poll round trip times. */
+typedef struct
+{
+    guint64  buckets[METRICS_BUCKETS + 1]; /*!< Observations in each bucket (not cumulative), the last is +Inf. */
+    guint64  count;                   /*!< Number of observations.                     */
+    gdouble  sum;                     /*!< Total of the observations, in seconds.      */
+} BUPSLatency;
+
+/*! What the client thread knows about one endpoint, for metrics_render(). */
+typedef struct
+{
+    gchar          *name;             /*!< "host:port", used as the endpoint label.    */
+    struct UPSData *sample;           /*!< Last published sample.                      */
+    guint           samples;          /*!< Number of samples published.                */
+    const gchar    *state;            /*!< Connection state, one of metrics_states[].  */
+    const gchar    *status;           /*!< NUT ups.status flags, NULL if not known.    */
+    BUPSLatency    *latency;          /*!< Poll round trip times, NULL if the server is not polled. */
+} BUPSMetricsEndpoint;
+
+extern const gchar *metrics_states[];
+
+extern gboolean metrics_open   (const gchar *address);
+extern void     metrics_close  (void);
+extern gint     metrics_pollfds(struct pollfd *fds, gint64 now, gint *timeout);
+extern gboolean metrics_waiting(struct pollfd *fds, gint count);
+extern void     metrics_io     (gint fd, gshort revents);
+extern void     metrics_render (BUPSMetricsEndpoint *endpoints, gint count);
+extern void     metrics_observe(BUPSLatency *latency, gint64 ms);
+
+#endif /* #ifndef _METRICS_H */
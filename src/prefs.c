@@ -31,6 +31,7 @@
 #include"version.h"
 #include"gkrellmbups.h"
 #include"ups_connect.h"
+#include"rollup.h"
 
 /* Some macros to make table additions neater */
 #define GTK_TABLE_DEFX ((GtkAttachOptions)(GTK_EXPAND | GTK_FILL))
@@ -76,39 +77,49 @@ static gchar *help_text[] =
     "\t$t\tUPS Temperature (in centigrade)\n", 
     "\t$l\tLoad level (as a percentage of maximum)\n", 
     "\n",
-    "Left click on charts to toggle the text overlay. Middle click on the UPS panel to\n",
-    "toggle a scrolling display of log messages from the UPS."
+    "<b>Any chart:\n",
+    "These work in the format of any chart:\n",
+    "\t${in_volt} ${out_volt} ${bat_volt} ${bat_level}\n",
+    "\t${in_freq} ${out_freq} ${temp} ${load}\n",
+    "\t${valN}\tField N of the Belkin VAL record\n",
+    "\n",
+    "<b>NUT hostname:\n",
+    "Give the hostname as upsname@hostname to monitor a particular UPS on a NUT server\n",
+    "with more than one, otherwise the first UPS the server lists is used.\n",
+    "\n",
+    "<b>gkrellmd:\n",
+    "When GKrellM is connected to a gkrellmd server with the gkrellmd_bups plugin\n",
+    "installed, the server can poll the UPS once for every GKrellM that is watching it.\n",
+    "Configure the UPS in gkrellmd.conf using the same mode, nut_host, nut_port,\n",
+    "belkin_host, belkin_port and pronet lines as the GKrellM config.\n",
+    "\n",
+    "<b>Alerts:\n",
+    "Add \"gkrellmbups alert <endpoint> <condition> <command>\" lines to the GKrellM\n",
+    "user config (or \"alert ...\" to gkrellmd.conf) to run a command as soon as a sample\n",
+    "meets a condition, such as \"bat_level<30\", \"temp>45\", \"OB\" (the NUT status has\n",
+    "the OB flag) or \"!OL\". The command gets the condition, endpoint and value as $1-$3.\n",
+    "\n",
+    "<b>Chart definitions:\n",
+    "Extra charts can be added with \"gkrellmbups chart <key> <endpoint> <values> <label>\"\n",
+    "lines in the GKrellM user config, for example \"chart load2 1 load,temp Loads\" plots\n",
+    "the load and temperature from the second server. Values are separated by commas\n",
+    "and named as in the format codes above. Charts for endpoints other than 0 only\n",
+    "show live samples. Once any chart line is given the default charts must be listed too.\n",
+    "\n",
+    "<b>Prometheus:\n",
+    "Add a \"gkrellmbups metrics_listen <port>\" line to the GKrellM user config (or\n",
+    "\"metrics_listen <port>\" to gkrellmd.conf) to serve OpenMetrics on localhost.\n",
+    "A unix socket path or address:port can be given instead of the port.\n",
+    "\n",
+    "Left click on charts to toggle the text overlay, middle click on a chart to switch\n",
+    "between live samples and one minute or one hour averages. Middle click on the UPS panel to\n",
+    "toggle a scrolling display of log messages from the UPS. Hover over the UPS panel\n",
+    "for connect, request, parse and update times, left click it to dump them to stderr."
 };
 
 /*! Plugin ownership and version information show in the About table of the plugin configuration. */
 static gchar about_text[] = "GKrellMBUPS %d.%d.%d\nGKrellM Belkin UPS Monitor plugin\n\n\nCopyright (C) 2001-2002 Chris Page\nChris <chris@starforge.co.uk>\nhttp://www.starforge.co.uk/gkrellm/\n\nReleased under the GPL.\n";
 
-/*! Options listed in the voltage chart format popup */
-static gchar *voltage_options[] = 
-{
-    "i:\\f$i,\\.o:\\f$o,\\nb:\\f$b",
-    "i:\\f$i,\\.o:\\f$o,\\nb:\\f$l%",
-    "i:\\f$i,\\.o:\\f$o",
-    "i:\\f$i\\no:\\f$o",
-    NULL
-};
-
-/*! Options listed in the frequency chart format popup */
-static gchar *frequency_options[] = 
-{
-    "i:\\f$i\\no:\\f$o",
-    "i:\\f$i,\\.o:\\f$o",
-    NULL
-};
-
-/*! Options listed in the temperature/load chart format popup */
-static gchar *temperature_options[] =
-{
-    "t:\\f$tC\\nl:\\f$l%",
-    "t:\\f$tC,\\.l:\\f$l%",
-    NULL
-};
-
 /*! Options listed in the mains popup */
 static gchar *mains_options[] =
 {
@@ -123,19 +134,16 @@ static gchar *mains_options[] =
 static GtkWidget *file_selector;
 
 /*! global widget pointers */
-static GtkWidget *voltage_combo;
-static GtkWidget *frequency_combo;
-static GtkWidget *temperature_combo;
+static GtkWidget **format_combos;  /* one for each of bups_data -> charts */
 static GtkWidget *mains_combo;
 static GtkWidget *client_mode;
-static GtkWidget *mode[4];
+static GtkWidget *mode[5];
+static gint       mode_values[5];   /* MODE_* value of each entry in mode[] */
 static GtkWidget *mode_options;
 static GtkWidget *pronet_location;
 static GtkWidget *remote_host;
 static GtkWidget *remote_port;
-static GtkWidget *show_volt;
-static GtkWidget *show_freq;
-static GtkWidget *show_stats;
+static GtkWidget **show_charts;    /* one for each of bups_data -> charts */
 static GtkWidget *show_msgs;
 
 #ifdef ENABLE_NUT
@@ -204,11 +212,11 @@ static void cb_mode_change(GtkWidget *widget, gpointer data)
     } 
 
     gtk_notebook_set_page(GTK_NOTEBOOK(mode_options), option);
-    activemode = option;
+    activemode = mode_values[option];
 #else
     option = gtk_option_menu_get_history(GTK_OPTION_MENU(client_mode));
     gtk_notebook_set_current_page(GTK_NOTEBOOK(mode_options),  option);
-    activemode = option;
+    activemode = mode_values[option];
 #endif
 }
 
@@ -288,10 +296,11 @@ static GtkWidget *create_combo(char **entries, char *initial)
     gchar     *item;
     GList     *combo_items = NULL;
     
-    /* build the combo list */
-    while((item = *entries++) != NULL) {
+    /* build the combo list, charts without a popup just list their current format */
+    while(entries && (item = *entries++) != NULL) {
         combo_items = g_list_append(combo_items, (gpointer)item);
     }
+    if(!combo_items) combo_items = g_list_append(combo_items, (gpointer)initial);
 
     combo = gtk_combo_new();
  
@@ -312,36 +321,36 @@ static GtkWidget *create_chart_frame(void)
     GtkWidget *chart_frame;
     GtkWidget *settings_table;
     GtkWidget *label;
+    BUPSChart *chart;
     gchar      mains_buffer[MAINS_BUF_SIZE];
+    gchar     *text;
+    gint       row;
     
     g_snprintf(mains_buffer, MAINS_BUF_SIZE, "%d", bups_data -> config -> mains);
 
     chart_frame = gtk_frame_new("Chart settings");
 
-    settings_table = gtk_table_new(4, 2, FALSE);
+    settings_table = gtk_table_new(bups_data -> chart_count + 1, 2, FALSE);
     gtk_table_set_row_spacings(GTK_TABLE(settings_table), 2);
     gtk_table_set_col_spacings(GTK_TABLE(settings_table), 2);
     gtk_container_add(GTK_CONTAINER(chart_frame), settings_table);
 
-    voltage_combo     = create_combo(voltage_options, bups_data -> volt_chart.text_format);
-    label             = create_label("Voltage chart format");
-    gtk_table_attach(GTK_TABLE(settings_table), voltage_combo, 0, 1, 0, 1, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
-    gtk_table_attach(GTK_TABLE(settings_table), label        , 1, 2, 0, 1, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
-
-    frequency_combo   = create_combo(frequency_options, bups_data -> freq_chart.text_format);
-    label             = create_label("Frequency chart format");
-    gtk_table_attach(GTK_TABLE(settings_table), frequency_combo, 0, 1, 1, 2, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
-    gtk_table_attach(GTK_TABLE(settings_table), label          , 1, 2, 1, 2, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
+    format_combos = g_renew(GtkWidget *, format_combos, bups_data -> chart_count);
+    for(row = 0; row < bups_data -> chart_count; ++row) {
+        chart = bups_data -> charts[row];
+        text  = g_strdup_printf("%s chart format", chart -> label);
 
-    temperature_combo = create_combo(temperature_options, bups_data -> temp_chart.text_format);
-    label             = create_label("Temperature/load chart format");
-    gtk_table_attach(GTK_TABLE(settings_table), temperature_combo, 0, 1, 2, 3, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
-    gtk_table_attach(GTK_TABLE(settings_table), label            , 1, 2, 2, 3, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
+        format_combos[row] = create_combo(chart -> options, chart -> text_format);
+        label              = create_label(text);
+        gtk_table_attach(GTK_TABLE(settings_table), format_combos[row], 0, 1, row, row + 1, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
+        gtk_table_attach(GTK_TABLE(settings_table), label             , 1, 2, row, row + 1, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
+        g_free(text);
+    }
 
     mains_combo       = create_combo(mains_options, mains_buffer);
     label             = create_label("Mains voltage offset");
-    gtk_table_attach(GTK_TABLE(settings_table), mains_combo, 0, 1, 3, 4, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
-    gtk_table_attach(GTK_TABLE(settings_table), label      , 1, 2, 3, 4, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
+    gtk_table_attach(GTK_TABLE(settings_table), mains_combo, 0, 1, row, row + 1, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
+    gtk_table_attach(GTK_TABLE(settings_table), label      , 1, 2, row, row + 1, GTK_TABLE_DEFX, GTK_TABLE_DEFY, 0, 0);
 
     gtk_widget_show(settings_table);
     gtk_widget_show(chart_frame);
@@ -500,12 +509,26 @@ static void create_nut_tab(GtkWidget *notebook)
 
 #endif /* #ifdef ENABLE_NUT */
 
+#ifdef BUPS_SERVE_DATA
+
+static void create_gkrellmd_tab(GtkWidget *notebook)
+{
+    GtkWidget *label;
+
+    label = create_label("The UPS is polled by the gkrellmd this GKrellM is connected to,\n"
+                         "which needs the gkrellmd_bups server plugin installed.");
+    gtk_container_add(GTK_CONTAINER(mode_options), label);
+}
+
+#endif /* #ifdef BUPS_SERVE_DATA */
+
 
 static GtkWidget *create_client_frame(void)
 {
     GtkWidget *client_frame;
     GtkWidget *client_settings;
     GtkWidget *menu;
+    gint       option, count = 0;
  
     client_frame = gtk_frame_new(_("UPS Server"));
 
@@ -516,17 +539,29 @@ static GtkWidget *create_client_frame(void)
     client_mode = gtk_option_menu_new();
 
     menu = gtk_menu_new();
-    mode[0] = create_menu_item(menu, "Local Belkin UPS (Sentry Bulldog upsd)");
-    mode[1] = create_menu_item(menu, "Remote Belkin UPS (Sentry Bulldog uspd)");
+    mode_values[count] = MODE_LOCAL;
+    mode[count++] = create_menu_item(menu, "Local Belkin UPS (Sentry Bulldog upsd)");
+    mode_values[count] = MODE_REMOTE;
+    mode[count++] = create_menu_item(menu, "Remote Belkin UPS (Sentry Bulldog uspd)");
 #ifdef ENABLE_NUT
-    mode[2] = create_menu_item(menu, "Network UPS Tools monitored UPS");
-    mode[3] = NULL;
-#else
-    mode[2] = NULL;
+    mode_values[count] = MODE_NUT;
+    mode[count++] = create_menu_item(menu, "Network UPS Tools monitored UPS");
+#endif
+#ifdef BUPS_SERVE_DATA
+    mode_values[count] = MODE_GKRELLMD;
+    mode[count++] = create_menu_item(menu, "UPS polled by the gkrellmd server");
 #endif
+    mode[count] = NULL;
+
+    /* menu entries don't line up with the MODE_* values when NUT is left out */
+    for(option = 0; (option < count) && (mode_values[option] != bups_data -> config -> mode); ++option) {
+        /* EMPTY */
+    }
+    if(option == count) option = 0;
+
     gtk_option_menu_set_menu(GTK_OPTION_MENU(client_mode), menu);
-    gtk_option_menu_set_history(GTK_OPTION_MENU(client_mode), bups_data -> config -> mode);
-    activemode = bups_data -> config -> mode;
+    gtk_option_menu_set_history(GTK_OPTION_MENU(client_mode), option);
+    activemode = mode_values[option];
 
     gtk_widget_show(client_mode);
     gtk_box_pack_start(GTK_BOX(client_settings), client_mode, FALSE, FALSE, 0);
@@ -545,12 +580,16 @@ static GtkWidget *create_client_frame(void)
     create_nut_tab(mode_options);
 #endif
 
+#ifdef BUPS_SERVE_DATA
+    create_gkrellmd_tab(mode_options);
+#endif
+
 #if (GKRELLMBUPS_VERSION_MAJOR == 1)
-    gtk_notebook_set_page(GTK_NOTEBOOK(mode_options),  bups_data -> config -> mode);
+    gtk_notebook_set_page(GTK_NOTEBOOK(mode_options),  option);
     gtk_signal_connect(GTK_OBJECT(menu), "selection-done", 
                        (GtkSignalFunc)cb_mode_change, NULL);
 #else 
-    gtk_notebook_set_current_page(GTK_NOTEBOOK(mode_options),  bups_data -> config -> mode);
+    gtk_notebook_set_current_page(GTK_NOTEBOOK(mode_options),  option);
     g_signal_connect(G_OBJECT(client_mode), "changed", 
                      G_CALLBACK(cb_mode_change), NULL);
 #endif
@@ -587,26 +626,23 @@ static void create_toggles_tab(GtkWidget *notebook)
     GtkWidget *toggles_vbox;
     GtkWidget *toggles;
     GtkWidget *tab_label;
+    gchar     *text;
+    gint       entry;
 
     toggles_vbox = gtk_vbox_new (FALSE, 0);
 
     toggles = gtk_vbox_new(FALSE, 0);
     gtk_widget_show(toggles);
 
-    show_volt = gtk_check_button_new_with_mnemonic(_("Show voltage chart"));
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_volt), bups_data -> config -> show_volt);
-    gtk_widget_show(show_volt);
-    gtk_box_pack_start(GTK_BOX(toggles), show_volt, FALSE, FALSE, 0);
-
-    show_freq = gtk_check_button_new_with_mnemonic(_("Show frequencies chart"));
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_freq), bups_data -> config -> show_freq);
-    gtk_widget_show(show_freq);
-    gtk_box_pack_start(GTK_BOX(toggles), show_freq, FALSE, FALSE, 0);
-
-    show_stats = gtk_check_button_new_with_mnemonic(_("Show temperature and load chart"));
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_stats), bups_data -> config -> show_stat);
-    gtk_widget_show(show_stats);
-    gtk_box_pack_start(GTK_BOX(toggles), show_stats, FALSE, FALSE, 0);
+    show_charts = g_renew(GtkWidget *, show_charts, bups_data -> chart_count);
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        text = g_strdup_printf("Show %s chart", bups_data -> charts[entry] -> label);
+        show_charts[entry] = gtk_check_button_new_with_label(text);
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_charts[entry]), !bups_data -> charts[entry] -> hidden);
+        gtk_widget_show(show_charts[entry]);
+        gtk_box_pack_start(GTK_BOX(toggles), show_charts[entry], FALSE, FALSE, 0);
+        g_free(text);
+    }
 
     show_msgs = gtk_check_button_new_with_mnemonic(_("Show UPS/Log panel"));
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_msgs), bups_data -> config -> show_msgs);
@@ -700,10 +736,10 @@ BUPSConfig *bups_create_config(void)
     config -> nut_password = NULL;
     config -> show_log     = FALSE;
     config -> mains        = MAINS_MIN;
-    config -> show_volt    = TRUE;
-    config -> show_freq    = TRUE;
-    config -> show_stat    = TRUE;
     config -> show_msgs    = TRUE;
+    config -> connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    config -> metrics_listen  = NULL;
+    config -> alert_count     = 0;
 
     if(file_selector == NULL) {
         file_selector = create_fileselect();
@@ -720,6 +756,9 @@ BUPSConfig *bups_create_config(void)
  */
 void bups_save_config(FILE *file)
 {
+    BUPSChart *chart;
+    gint       endpoint, entry, metric;
+
     /*  config structure */
     fprintf(file, "%s mode %d\n"        , MONITOR_CONFIG_KEYWORD, bups_data -> config -> mode);
     fprintf(file, "%s pronet %s\n"      , MONITOR_CONFIG_KEYWORD, bups_data -> config -> pro_net);
@@ -733,36 +772,64 @@ void bups_save_config(FILE *file)
     fprintf(file, "%s showlog %d\n"     , MONITOR_CONFIG_KEYWORD, bups_data -> config -> show_log);
     fprintf(file, "%s mains %d\n"       , MONITOR_CONFIG_KEYWORD, bups_data -> config -> mains);
 
-    fprintf(file, "%s showvolt %d\n"    , MONITOR_CONFIG_KEYWORD, bups_data -> config -> show_volt);
-    fprintf(file, "%s showfreq %d\n"    , MONITOR_CONFIG_KEYWORD, bups_data -> config -> show_freq);
-    fprintf(file, "%s showstat %d\n"    , MONITOR_CONFIG_KEYWORD, bups_data -> config -> show_stat);
     fprintf(file, "%s showmsgs %d\n"    , MONITOR_CONFIG_KEYWORD, bups_data -> config -> show_msgs);
+    fprintf(file, "%s connect_timeout %d\n", MONITOR_CONFIG_KEYWORD, bups_data -> config -> connect_timeout);
+    if(bups_data -> config -> metrics_listen) {
+        fprintf(file, "%s metrics_listen %s\n", MONITOR_CONFIG_KEYWORD, bups_data -> config -> metrics_listen);
+    }
 
+    for(endpoint = 0; endpoint < bups_data -> config -> endpoint_count; ++endpoint) {
+        fprintf(file, "%s endpoint %d %s %d\n", MONITOR_CONFIG_KEYWORD, 
+                bups_data -> config -> endpoints[endpoint].mode,
+                bups_data -> config -> endpoints[endpoint].host,
+                bups_data -> config -> endpoints[endpoint].port);
+    }
+
+    for(entry = 0; entry < bups_data -> config -> alert_count; ++entry) {
+        fprintf(file, "%s alert %s\n", MONITOR_CONFIG_KEYWORD, bups_data -> config -> alerts[entry]);
+    }
+
+    /* chart definitions, these have to be loaded before the other chart settings */
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        chart = bups_data -> charts[entry];
+
+        fprintf(file, "%s chart %s %d ", MONITOR_CONFIG_KEYWORD, chart -> key, chart -> endpoint);
+        for(metric = 0; metric < chart -> metric_count; ++metric) {
+            fprintf(file, "%s%s", metric ? "," : "", format_metrics[chart -> metrics[metric]].name);
+        }
+        fprintf(file, " %s\n", chart -> label);
+    }
 
     /* chart structures */
-    fprintf(file, "%s volt_format %s\n", MONITOR_CONFIG_KEYWORD, bups_data -> volt_chart.text_format);
-    fprintf(file, "%s freq_format %s\n", MONITOR_CONFIG_KEYWORD, bups_data -> freq_chart.text_format);
-    fprintf(file, "%s temp_format %s\n", MONITOR_CONFIG_KEYWORD, bups_data -> temp_chart.text_format);
-    fprintf(file, "%s show_volt %d\n"  , MONITOR_CONFIG_KEYWORD, bups_data -> volt_chart.show_text);
-    fprintf(file, "%s show_freq %d\n"  , MONITOR_CONFIG_KEYWORD, bups_data -> freq_chart.show_text);
-    fprintf(file, "%s show_temp %d\n"  , MONITOR_CONFIG_KEYWORD, bups_data -> temp_chart.show_text);
-
-	gkrellm_save_chartconfig(file, bups_data -> volt_chart.config, MONITOR_CONFIG_KEYWORD, "volt");
-	gkrellm_save_chartconfig(file, bups_data -> freq_chart.config, MONITOR_CONFIG_KEYWORD, "freq");
-	gkrellm_save_chartconfig(file, bups_data -> temp_chart.config, MONITOR_CONFIG_KEYWORD, "temp");
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        chart = bups_data -> charts[entry];
+
+        fprintf(file, "%s chart_show %s %d\n"  , MONITOR_CONFIG_KEYWORD, chart -> key, !chart -> hidden);
+        fprintf(file, "%s chart_text %s %d\n"  , MONITOR_CONFIG_KEYWORD, chart -> key, chart -> show_text);
+        fprintf(file, "%s chart_res %s %d\n"   , MONITOR_CONFIG_KEYWORD, chart -> key, chart -> resolution);
+        fprintf(file, "%s chart_format %s %s\n", MONITOR_CONFIG_KEYWORD, chart -> key, chart -> text_format);
+	    gkrellm_save_chartconfig(file, chart -> config, MONITOR_CONFIG_KEYWORD, chart -> key);
+    }
 }
 
 
 /** Load the user settings.
  *  Attepts to extract Useful Information(tm) from a string presented to the
  *  function buy GKrellM. Things are slightly more complicated than the average
- *  case by the fact that we need to distinguish between three chartconfig lines
- *  rather than the single chart must plugins deal with.
+ *  case by the fact that we need to distinguish between the chartconfig lines
+ *  of any number of charts rather than the single chart must plugins deal with.
+ *  Chart settings are all "<keyword> <chart key> <value>", the first "chart"
+ *  definition replaces the default charts. Configs saved before charts were 
+ *  defined in the config use the older volt/freq/temp keywords.
  */
 void bups_load_config(gchar *line)
 {
-    gchar keyword[31], name[31];
-    gchar data[CONFIG_BUFSIZE], conf[CONFIG_BUFSIZE];
+    static gboolean charts_defined = FALSE;
+
+    BUPSChart *chart;
+    gchar      keyword[31], name[31];
+    gchar      data[CONFIG_BUFSIZE], conf[CONFIG_BUFSIZE], label[CONFIG_BUFSIZE];
+    gint       mode, port, count;
 
     if(2 == sscanf(line, "%31s %[^\n]", keyword, data)) {
         /* config structure */
@@ -788,40 +855,71 @@ void bups_load_config(gchar *line)
             bups_data -> config -> mains = strtol(data, NULL, 10);
         } else if(!strcmp(keyword, "showlog")) {
             bups_data -> config -> show_log = strtol(data, NULL, 10);
-        } else if(!strcmp(keyword, "showvolt")) {
-            bups_data -> config -> show_volt = strtol(data, NULL, 10);
-        } else if(!strcmp(keyword, "showfreq")) {
-            bups_data -> config -> show_freq = strtol(data, NULL, 10);
-        } else if(!strcmp(keyword, "showstat")) {
-            bups_data -> config -> show_stat = strtol(data, NULL, 10);
         } else if(!strcmp(keyword, "showmsgs")) {
             bups_data -> config -> show_msgs = strtol(data, NULL, 10);
+        } else if(!strcmp(keyword, "connect_timeout")) {
+            bups_data -> config -> connect_timeout = strtol(data, NULL, 10);
+        } else if(!strcmp(keyword, "metrics_listen")) {
+            g_free(bups_data -> config -> metrics_listen);
+            bups_data -> config -> metrics_listen = g_strdup(data);
+        } else if(!strcmp(keyword, "endpoint")) {
+            /* additional server, "<mode> <host> <port>" */
+            if((3 == sscanf(data, "%d %255s %d", &mode, conf, &port)) && 
+               (bups_data -> config -> endpoint_count < (MAX_ENDPOINTS - 1))) {
+                bups_data -> config -> endpoints[bups_data -> config -> endpoint_count].mode = (mode == MODE_NUT) ? MODE_NUT : MODE_REMOTE;
+                bups_data -> config -> endpoints[bups_data -> config -> endpoint_count].host = g_strdup(conf);
+                bups_data -> config -> endpoints[bups_data -> config -> endpoint_count].port = port;
+                bups_data -> config -> endpoint_count ++;
+            }
+        } else if(!strcmp(keyword, "alert")) {
+            /* alert rule, "<endpoint> <condition> <command>", checked when the client starts */
+            if(bups_data -> config -> alert_count < MAX_ALERTS) {
+                bups_data -> config -> alerts[bups_data -> config -> alert_count++] = g_strdup(data);
+            }
+
+        /* Chart definitions, "<key> <endpoint> <values> <label>" */
+        } else if(!strcmp(keyword, "chart")) {
+            if((count = sscanf(data, "%31s %d %255s %[^\n]", name, &port, conf, label)) >= 3) {
+                if(!charts_defined) bups_clear_charts();
+                charts_defined = TRUE;
+                bups_define_chart(name, port, conf, (count == 4) ? label : name);
+            }
 
         /* Chart structures */ 
-        } else if(!strcmp(keyword, "volt_format")) {
-            gkrellm_dup_string(&bups_data -> volt_chart.text_format, data);
-        } else if(!strcmp(keyword, "freq_format")) {
-            gkrellm_dup_string(&bups_data -> freq_chart.text_format, data);
-        } else if(!strcmp(keyword, "temp_format")) {
-            gkrellm_dup_string(&bups_data -> temp_chart.text_format, data);
-        } else if(!strcmp(keyword, "show_volt")) {
-            bups_data -> volt_chart.show_text = strtol(data, NULL, 10);
-        } else if(!strcmp(keyword, "show_freq")) {
-            bups_data -> freq_chart.show_text = strtol(data, NULL, 10);
-        } else if(!strcmp(keyword, "show_temp")) {
-            bups_data -> temp_chart.show_text = strtol(data, NULL, 10);
-        } else if(!strcmp(keyword, GKRELLM_CHARTCONFIG_KEYWORD)) {
-
-            /* line is a chartconfig, need to do a bit more parsing to work out 
-             * which chart this is the config for..
-             */
-            if(2 == sscanf(data, "%31s %[^\n]", name, conf)) {
-                if(!strcmp(name, "volt")) {
-                    gkrellm_load_chartconfig(&bups_data -> volt_chart.config, conf, 3);
-                } else if(!strcmp(name, "freq")) {
-                    gkrellm_load_chartconfig(&bups_data -> freq_chart.config, conf, 2);
-                } else if(!strcmp(name, "temp")) {
-                    gkrellm_load_chartconfig(&bups_data -> temp_chart.config, conf, 2);
+        } else if((2 == sscanf(data, "%31s %[^\n]", name, conf)) && ((chart = bups_find_chart(name)) != NULL)) {
+            if(!strcmp(keyword, "chart_show")) {
+                chart -> hidden = !strtol(conf, NULL, 10);
+            } else if(!strcmp(keyword, "chart_text")) {
+                chart -> show_text = strtol(conf, NULL, 10);
+            } else if(!strcmp(keyword, "chart_res")) {
+                chart -> resolution = chart -> endpoint ? ROLLUP_SECOND : CLAMP(strtol(conf, NULL, 10), 0, ROLLUP_TIERS - 1);
+            } else if(!strcmp(keyword, "chart_format")) {
+                bups_set_format(chart, conf);
+            } else if(!strcmp(keyword, GKRELLM_CHARTCONFIG_KEYWORD)) {
+                gkrellm_load_chartconfig(&chart -> config, conf, chart -> metric_count);
+            }
+
+        /* Chart settings from before charts were defined in the config: showvolt, showfreq 
+         * and showstat (the temp chart), show_<key>, <key>_format and <key>_res 
+         */
+        } else if(!strcmp(keyword, "showvolt") || !strcmp(keyword, "showfreq") || !strcmp(keyword, "showstat")) {
+            if((chart = bups_find_chart(strcmp(keyword, "showstat") ? keyword + 4 : "temp")) != NULL) {
+                chart -> hidden = !strtol(data, NULL, 10);
+            }
+        } else if(!strncmp(keyword, "show_", 5)) {
+            if((chart = bups_find_chart(keyword + 5)) != NULL) {
+                chart -> show_text = strtol(data, NULL, 10);
+            }
+        /* only the volt, freq and temp charts existed in old configs, a chart
+         * defined since then gets its format and resolution from its chart line
+         */
+        } else if(!strncmp(keyword, "volt_", 5) || !strncmp(keyword, "freq_", 5) || !strncmp(keyword, "temp_", 5)) {
+            g_strlcpy(name, keyword, 5);
+            if((chart = bups_find_chart(name)) != NULL) {
+                if(!strcmp(keyword + 4, "_format")) {
+                    bups_set_format(chart, data);
+                } else if(!strcmp(keyword + 4, "_res")) {
+                    chart -> resolution = CLAMP(strtol(data, NULL, 10), 0, ROLLUP_TIERS - 1);
                 }
             }
         }
@@ -837,7 +935,7 @@ void bups_load_config(gchar *line)
 void bups_apply_config(void)
 {
     const gchar    *contents;
-    gint      portset, oldmode;
+    gint      portset, oldmode, entry;
     gboolean  update_local  = FALSE;
     gboolean  update_remote = FALSE;
 
@@ -845,44 +943,16 @@ void bups_apply_config(void)
     gboolean update_nut    = FALSE;
 #endif
 
-    bups_data -> config -> show_volt = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_volt));
-    bups_data -> config -> show_freq = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_freq));
-    bups_data -> config -> show_stat = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_stats));
     bups_data -> config -> show_msgs = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_msgs));
 
-    /* show/hide sections */
-    if(bups_data -> config -> show_volt) {
-        gkrellm_chart_show(bups_data -> volt_chart.chart, TRUE);
-    } else {
-        gkrellm_chart_hide(bups_data -> volt_chart.chart, TRUE);
-    }
-
-    if(bups_data -> config -> show_freq) {
-        gkrellm_chart_show(bups_data -> freq_chart.chart, TRUE);
-    } else {
-        gkrellm_chart_hide(bups_data -> freq_chart.chart, TRUE);
-     }
-
-    if(bups_data -> config -> show_stat) {
-        gkrellm_chart_show(bups_data -> temp_chart.chart, TRUE);
-    } else {
-        gkrellm_chart_hide(bups_data -> temp_chart.chart, TRUE);
-    }
+    /* show/hide sections, formats are only recompiled (and the overlays redrawn) if they changed */
+    for(entry = 0; entry < bups_data -> chart_count; ++entry) {
+        bups_show_chart(bups_data -> charts[entry], gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_charts[entry])));
 
-    if(bups_data -> config -> show_msgs) {
-        gkrellm_panel_show(bups_data -> log_display);
-    } else {
-        gkrellm_panel_hide(bups_data -> log_display);
+        contents = gtk_entry_get_text(GTK_ENTRY(GTK_COMBO(format_combos[entry])->entry));
+        bups_set_format(bups_data -> charts[entry], (gchar *)contents);
     }
-
-    contents = gtk_entry_get_text(GTK_ENTRY(GTK_COMBO(voltage_combo)->entry));
-    gkrellm_dup_string(&bups_data -> volt_chart.text_format, (gchar *)contents);
-
-    contents = gtk_entry_get_text(GTK_ENTRY(GTK_COMBO(frequency_combo)->entry));
-    gkrellm_dup_string(&bups_data -> freq_chart.text_format, (gchar *)contents);
-
-    contents = gtk_entry_get_text(GTK_ENTRY(GTK_COMBO(temperature_combo)->entry));
-    gkrellm_dup_string(&bups_data -> temp_chart.text_format, (gchar *)contents);
+    bups_show_log(bups_data -> config -> show_msgs);
 
     contents = gtk_entry_get_text(GTK_ENTRY(GTK_COMBO(mains_combo)->entry));    
     bups_data -> config -> mains = strtol(contents, NULL, 0);
@@ -23,12 +23,16 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H 1
 
+/* the gkrellmd server plugin only needs the config structure, not GTK */
+#ifndef GKRELLMD_VERSION_MAJOR
 #ifndef GKRELLM_VERSION_MAJOR
     #include<gkrellm2/gkrellm.h>
 #endif
+#include<gtk/gtk.h>
+#endif
 
+#include<stdio.h>
 #include<glib.h>
-#include<gtk/gtk.h>
 
 /*! Value to subtract from input and output mains voltages.
  *  Mains voltages are typically 220 to 240 in the UK, this presented some problems with
@@ -46,6 +50,7 @@
 #define MODE_LOCAL              0             /*!< Monitor a local Belkin UPS (Sentry Bulldog)      */
 #define MODE_REMOTE             1             /*!< Monitor a remote Belkin UPS (Sentry Bulldog)     */
 #define MODE_NUT                2             /*!< Monitor a UPS via NUT                            */
+#define MODE_GKRELLMD           3             /*!< Take the UPS data from the gkrellmd server plugin */
 
 #define DEFAULT_MODE            MODE_LOCAL    /*!< Default to local Belkin monitoring               */
 #define DEFAULT_PRONET          "/usr/local/bulldog/PRO_NET.DAT"  /*<! Default location of UPS data */
@@ -55,6 +60,10 @@
 #define DEFAULT_NUT_PORT        3493          /*!< Official IANA NUT port.                          */
 #define DEFAULT_NUT_AUTH        0             /*!< Enable authorisation stuff. Default is no (0)    */
 
+#define MAX_ENDPOINTS           32            /*!< Maximum number of servers the client will watch  */
+#define DEFAULT_CONNECT_TIMEOUT 5000          /*!< Milliseconds allowed for connecting to a server  */
+#define MAX_ALERTS              16            /*!< Maximum number of alert rules, see alert.c       */
+
 #define DEFAULT_VFORMAT "i:\\f$i,\\.o:\\f$o,\\nb:\\f$l%" /*<! Default voltage chart format.         */
 #define DEFAULT_FFORMAT "i:\\f$i\\no:\\f$o"              /*<! Default frequency chart format.       */ 
 #define DEFAULT_TFORMAT "t:\\f$tC\\nl:\\f$l%"            /*<! Default temperature chart format.     */
@@ -62,6 +71,17 @@
 /*! Size of the buffers used for storing configuration data in loadConfig().                        */
 #define CONFIG_BUFSIZE 256         
 
+/*! Additional server to monitor.
+ *  The server selected in the configuration tab is always monitored, any number of these (up to
+ *  MAX_ENDPOINTS - 1) can be listed in the config file with "endpoint <mode> <host> <port>" lines.
+ */
+typedef struct
+{
+    gint         mode;                       /*!< MODE_REMOTE or MODE_NUT                                                   */
+    gchar       *host;                       /*!< Hostname the server is running on.                                        */
+    gint         port;                       /*!< Port the server is accepting connections on.                              */
+} BUPSEndpoint;
+
 /*! Configuration option storage.
  *  The non-chart-specific options are stored in this structure. Information specific to charts
  *  (text formats etc) is stored in the chart structure. 
@@ -79,16 +99,21 @@ typedef struct
     gchar       *nut_password;               /*!< Password to pass to NUT                                                   */
     gint         show_log;                   /*!< 0 to show label, 1 to show log.                                           */
     gint         mains;                      /*!< Utility low battery transfer voltage or similar.                          */ 
-    gboolean     show_volt;                  /*!< Show the voltages? Defaults to TRUE.                                      */
-    gboolean     show_freq;                  /*!< Show the frequencies? Defaults to TRUE.                                   */
-    gboolean     show_stat;                  /*!< Show the statistics? Defaults to TRUE.                                    */
     gboolean     show_msgs;                  /*!< Show the log message bar? Defaults to TRUE.                               */
+    BUPSEndpoint endpoints[MAX_ENDPOINTS];   /*!< Additional servers to monitor.                                            */
+    gint         endpoint_count;             /*!< Number of valid entries in endpoints.                                     */
+    gint         connect_timeout;            /*!< Milliseconds allowed for connecting to a server (all addresses).          */
+    gchar       *metrics_listen;             /*!< Unix socket path or [address:]port to serve metrics on, NULL for none.    */
+    gchar       *alerts[MAX_ALERTS];         /*!< Alert rules, "<endpoint> <condition> <command>".                          */
+    gint         alert_count;                /*!< Number of valid entries in alerts.                                        */
 } BUPSConfig;
 
+#ifndef GKRELLMD_VERSION_MAJOR
 extern void        bups_create_gui   (GtkWidget *tab);
 extern BUPSConfig *bups_create_config(void);
 extern void        bups_save_config  (FILE *file);
 extern void        bups_load_config  (gchar *line);
 extern void        bups_apply_config (void);
+#endif
 
 #endif /* #ifndef _CONFIG_H */
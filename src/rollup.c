@@ -0,0 +1,209 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file rollup.c
+ *  Multi-resolution summaries of the UPS samples.
+ *  Every sample is folded into the current bucket of each tier (a minute and
+ *  an hour) which keep the min, max, sum and count of each value. The charts
+ *  showing seconds plot the samples themselves (live and from the history 
+ *  file), so that tier has a name but no buckets.
+ *  Each tier is a fixed ring of buckets, so memory use is bounded and adding
+ *  a sample costs the same however long the plugin has been running. The 
+ *  charts can then show hours or days of data by plotting the bucket averages
+ *  instead of individual samples.
+ */
+/*  $Id: rollup.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<string.h>
+#include"gkrellmbups.h"
+#include"rollup.h"
+
+/*! Per-tier settings: how long a bucket lasts, how many are kept (none for a
+ *  tier that isn't rolled up) and the name shown on the chart. 
+ */
+static struct
+{
+    gint         seconds;
+    gint         buckets;
+    const gchar *name;
+} tiers[ROLLUP_TIERS] =
+{
+    {    1,    0, "1s"  },   /* the samples */
+    {   60, 1440, "1m"  },   /* a day       */
+    { 3600,  720, "1h"  }    /* a month     */
+};
+
+/*! Offset of each metric in UPSData, in ROLLUP_* order. */
+static const glong metric_offsets[ROLLUP_METRICS] =
+{
+    G_STRUCT_OFFSET(struct UPSData, in_Voltage),
+    G_STRUCT_OFFSET(struct UPSData, out_Voltage),
+    G_STRUCT_OFFSET(struct UPSData, bat_Voltage),
+    G_STRUCT_OFFSET(struct UPSData, bat_Level),
+    G_STRUCT_OFFSET(struct UPSData, in_Freq),
+    G_STRUCT_OFFSET(struct UPSData, out_Freq),
+    G_STRUCT_OFFSET(struct UPSData, ups_Load),
+    G_STRUCT_OFFSET(struct UPSData, ups_Temp)
+};
+
+/*! Ring of buckets for each tier, allocated on first use. */
+static BUPSRollupBucket *rings[ROLLUP_TIERS];
+
+/*! Period number (time / tier seconds) of the current bucket in each tier, 0 before the first sample. */
+static time_t current[ROLLUP_TIERS];
+
+
+/** Find the buckets for the specified period in a tier.
+ */
+static BUPSRollupBucket *period_buckets(gint tier, time_t period)
+{
+    return &rings[tier][(period % tiers[tier].buckets) * ROLLUP_METRICS];
+}
+
+
+/** Add a sample to every tier.
+ *  When the sample falls in a later period than the current bucket, the 
+ *  buckets for the periods in between (no samples, the UPS was missing or 
+ *  GKrellM wasn't running) are emptied and the tier moves on. Samples 
+ *  without valid values (see UPSData.ups_Valid) still move the tiers on but
+ *  are not counted.
+ *
+ *  \par Arguments:
+ *  \arg \c sample - Sample to add.
+ *  \arg \c now - Wall clock time of the sample.
+ *  \arg \c skipped - If not NULL, set to the number of periods each tier
+ *                      skipped over (the completed bucket is then that many
+ *                      plus one back), for the charts to show as gaps.
+ *  \return A bitmask (1 << tier) of the tiers that completed a bucket.
+ */
+guint rollup_add(struct UPSData *sample, time_t now, gint *skipped)
+{
+    BUPSRollupBucket *bucket;
+    time_t            period, skip;
+    guint             completed = 0;
+    gint              tier, metric;
+    gfloat            value;
+
+    for(tier = 0; tier < ROLLUP_TIERS; ++tier) {
+        if(skipped) skipped[tier] = 0;
+        if(!tiers[tier].buckets) continue;
+        if(rings[tier] == NULL) {
+            rings[tier] = g_new0(BUPSRollupBucket, tiers[tier].buckets * ROLLUP_METRICS);
+        }
+
+        period = now / tiers[tier].seconds;
+        if(period != current[tier]) {
+            if(current[tier]) completed |= (1 << tier);
+            if(skipped && current[tier] && (period > current[tier])) {
+                skipped[tier] = (gint)MIN(period - current[tier] - 1, tiers[tier].buckets);
+            }
+
+            /* empty the buckets we are moving over, there's no point going round more than once */
+            skip = (current[tier] && (period > current[tier])) ? MIN(period - current[tier], tiers[tier].buckets) : 1;
+            while(skip--) {
+                memset(period_buckets(tier, period - skip), 0, ROLLUP_METRICS * sizeof(BUPSRollupBucket));
+            }
+            current[tier] = period;
+        }
+
+        if(!sample -> ups_Valid) continue;
+
+        bucket = period_buckets(tier, period);
+        for(metric = 0; metric < ROLLUP_METRICS; ++metric, ++bucket) {
+            value = *(gfloat *)((gchar *)sample + metric_offsets[metric]);
+            if(!bucket -> count || (value < bucket -> min)) bucket -> min = value;
+            if(!bucket -> count || (value > bucket -> max)) bucket -> max = value;
+            bucket -> sum += value;
+            bucket -> count++;
+        }
+    }
+
+    return completed;
+}
+
+
+/** Get the summary of one metric in a tier.
+ *
+ *  \par Arguments:
+ *  \arg \c tier - ROLLUP_SECOND, ROLLUP_MINUTE or ROLLUP_HOUR.
+ *  \arg \c age - 0 for the current (incomplete) bucket, 1 for the last complete one and so on.
+ *  \arg \c metric - One of the ROLLUP_* metric numbers.
+ *  \return The bucket, or NULL if age is out of range or there have been no samples.
+ */
+BUPSRollupBucket *rollup_bucket(gint tier, gint age, gint metric)
+{
+    if((tier < 0) || (tier >= ROLLUP_TIERS) || !current[tier] || 
+       (age < 0) || (age >= tiers[tier].buckets) || (current[tier] < age)) return NULL;
+
+    return period_buckets(tier, current[tier] - age) + metric;
+}
+
+
+/** Fill in a UPSData with the averages from a bucket.
+ *  Empty buckets give zeros and ups_Present and ups_Valid FALSE.
+ *
+ *  \return TRUE if the bucket had any samples in it.
+ */
+gboolean rollup_average(gint tier, gint age, struct UPSData *dest)
+{
+    BUPSRollupBucket *bucket;
+    gint              metric;
+
+    memset(dest, 0, sizeof(struct UPSData));
+    if((bucket = rollup_bucket(tier, age, 0)) == NULL) return FALSE;
+
+    for(metric = 0; metric < ROLLUP_METRICS; ++metric, ++bucket) {
+        *(gfloat *)((gchar *)dest + metric_offsets[metric]) = bucket -> count ? (gfloat)(bucket -> sum / bucket -> count) : 0.0;
+    }
+    dest -> ups_Present = dest -> ups_Valid = (bucket[-1].count != 0);
+
+    return dest -> ups_Valid;
+}
+
+
+/** Replay the averages of the most recent complete buckets in a tier, oldest first.
+ *
+ *  \par Arguments:
+ *  \arg \c tier - Tier to replay.
+ *  \arg \c count - Maximum number of buckets to replay.
+ *  \arg \c store - Function called for each bucket.
+ *  \arg \c data - Passed to store.
+ *  \return The number of buckets replayed.
+ */
+gint rollup_replay(gint tier, gint count, void (*store)(struct UPSData *, gpointer), gpointer data)
+{
+    struct UPSData average;
+    gint           age;
+
+    if((tier < 0) || (tier >= ROLLUP_TIERS) || !current[tier]) return 0;
+
+    count = MIN(count, tiers[tier].buckets - 1);
+    for(age = count; age > 0; --age) {
+        rollup_average(tier, age, &average);
+        store(&average, data);
+    }
+
+    return count;
+}
+
+
+/** Short name for a tier ("1s", "1m" or "1h").
+ */
+const gchar *rollup_tier_name(gint tier)
+{
+    return ((tier >= 0) && (tier < ROLLUP_TIERS)) ? tiers[tier].name : "";
+}
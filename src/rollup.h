@@ -0,0 +1,59 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file rollup.h
+ *  Functions exported by rollup.c and the rollup tier definitions.
+ */
+/*  $Id: rollup.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _ROLLUP_H
+#define _ROLLUP_H 1
+
+#include<glib.h>
+#include<time.h>
+#include"ups_connect.h"
+
+#define ROLLUP_SECOND    0   /*!< The samples themselves, not rolled up. */
+#define ROLLUP_MINUTE    1   /*!< One bucket per minute.  */
+#define ROLLUP_HOUR      2   /*!< One bucket per hour.    */
+#define ROLLUP_TIERS     3   /*!< Number of resolutions.  */
+
+#define ROLLUP_IN_VOLT   0   /*!< UPSData.in_Voltage      */
+#define ROLLUP_OUT_VOLT  1   /*!< UPSData.out_Voltage     */
+#define ROLLUP_BAT_VOLT  2   /*!< UPSData.bat_Voltage     */
+#define ROLLUP_BAT_LEVEL 3   /*!< UPSData.bat_Level       */
+#define ROLLUP_IN_FREQ   4   /*!< UPSData.in_Freq         */
+#define ROLLUP_OUT_FREQ  5   /*!< UPSData.out_Freq        */
+#define ROLLUP_LOAD      6   /*!< UPSData.ups_Load        */
+#define ROLLUP_TEMP      7   /*!< UPSData.ups_Temp        */
+#define ROLLUP_METRICS   8   /*!< Number of values rolled up. */
+
+/*! Summary of one metric over the period covered by a bucket. */
+typedef struct
+{
+    gfloat  min;                     /*!< Smallest value seen.                    */
+    gfloat  max;                     /*!< Largest value seen.                     */
+    gdouble sum;                     /*!< Sum of the values seen, for the average. */
+    guint   count;                   /*!< Number of values seen, 0 if the bucket is empty. */
+} BUPSRollupBucket;
+
+extern guint             rollup_add      (struct UPSData *sample, time_t now, gint *skipped);
+extern gboolean          rollup_average  (gint tier, gint age, struct UPSData *dest);
+extern BUPSRollupBucket *rollup_bucket   (gint tier, gint age, gint metric);
+extern gint              rollup_replay   (gint tier, gint count, void (*store)(struct UPSData *, gpointer), gpointer data);
+extern const gchar      *rollup_tier_name(gint tier);
+
+#endif /* #ifndef _ROLLUP_H */
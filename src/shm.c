@@ -0,0 +1,155 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file shm.c
+ *  Shared memory sample publisher.
+ *  Local scripts that want the UPS status can read it from a POSIX shared
+ *  memory segment instead of opening yet another connection to the UPS 
+ *  server. The client thread copies every sample of the first endpoint into 
+ *  the segment under a sequence lock, along with a small ring of recent 
+ *  samples, see bups_shm.h for the layout and the reader functions.
+ *
+ *  The segment is named after the user running the plugin and is left in
+ *  place when GKrellM exits, the sample times show how stale it is. The name
+ *  is easy to guess, so one that somebody else got to first is removed (if
+ *  the sticky /dev/shm lets us) rather than written to.
+ */
+/*  $Id: shm.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<stdio.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#define BUPS_SHM_WRITER 1
+#include"bups_shm.h"
+#include"shm.h"
+
+static BUPSShm *segment = NULL; /*!< The mapped segment, NULL if it could not be created. */
+
+
+/** Open the segment, creating it if need be.
+ *  An existing segment is only reused if it belongs to us, anything else is
+ *  unlinked and created again. Creating with O_EXCL means nobody can slip 
+ *  a segment of their own in between.
+ *
+ *  \return The descriptor, or -1 if the segment could not be opened.
+ */
+static gint shm_create(const gchar *name)
+{
+    struct stat st;
+    gint        fd, attempt;
+
+    for(attempt = 0; attempt < 2; ++attempt) {
+        if((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) >= 0) return fd;
+        if(errno != EEXIST) break;
+
+        if((fd = shm_open(name, O_RDWR, 0)) >= 0) {
+            if((fstat(fd, &st) == 0) && (st.st_uid == getuid())) {
+                fchmod(fd, 0644);
+                return fd;
+            }
+            close(fd);
+        }
+
+        fprintf(stderr, "shm_open_segment: %s belongs to someone else, replacing it\n", name);
+        if(shm_unlink(name) < 0) break;
+    }
+
+    perror("shm_open_segment: unable to open shared memory segment");
+    return -1;
+}
+
+
+/** Create (or reuse) and map the segment.
+ *  Only the first call does anything, the segment stays mapped until the 
+ *  process exits so the client thread can be restarted freely.
+ *
+ *  \return TRUE if the segment is available.
+ */
+gboolean shm_open_segment(void)
+{
+    gchar name[32];
+    gint  fd;
+    void *map;
+
+    if(segment) return TRUE;
+
+    g_snprintf(name, sizeof(name), BUPS_SHM_PREFIX "%u", (unsigned)getuid());
+    if((fd = shm_create(name)) < 0) return FALSE;
+
+    if(ftruncate(fd, sizeof(BUPSShm)) < 0) {
+        perror("shm_open_segment: unable to size shared memory segment");
+        close(fd);
+        return FALSE;
+    }
+
+    map = mmap(NULL, sizeof(BUPSShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        perror("shm_open_segment: unable to map shared memory segment");
+        return FALSE;
+    }
+
+    /* start again, whatever an earlier publisher left is of no use */
+    segment = map;
+    g_atomic_int_inc((gint *)&segment -> seq);
+    memset(segment -> log, 0, sizeof(segment -> log) + sizeof(segment -> ring));
+    segment -> count   = 0;
+    segment -> pid     = getpid();
+    segment -> version = BUPS_SHM_VERSION;
+    segment -> magic   = BUPS_SHM_MAGIC;
+    if(segment -> seq & 1) g_atomic_int_inc((gint *)&segment -> seq);
+
+    return TRUE;
+}
+
+
+/** Publish a sample to the segment.
+ *  Called from the client thread for each sample of the first endpoint. Does
+ *  nothing if the segment could not be created.
+ */
+void shm_publish(struct UPSData *sample)
+{
+    BUPSShmSample *slot;
+
+    if(!segment) return;
+
+    g_atomic_int_inc((gint *)&segment -> seq);
+
+    slot = &segment -> ring[segment -> count % BUPS_SHM_RING];
+    slot -> time        = time(NULL);
+    slot -> bat_voltage = sample -> bat_Voltage;
+    slot -> bat_level   = sample -> bat_Level;
+    slot -> in_freq     = sample -> in_Freq;
+    slot -> in_voltage  = sample -> in_Voltage;
+    slot -> out_freq    = sample -> out_Freq;
+    slot -> out_voltage = sample -> out_Voltage;
+    slot -> load        = sample -> ups_Load;
+    slot -> temp        = sample -> ups_Temp;
+    slot -> present     = sample -> ups_Present ? 1 : 0;
+    slot -> valid       = sample -> ups_Valid ? 1 : 0;
+    slot -> log_seq     = sample -> log_Seq;
+    slot -> number      = ++segment -> count;
+    g_strlcpy(segment -> log, sample -> ups_LastLog, BUPS_SHM_LOGSIZE);
+
+    g_atomic_int_inc((gint *)&segment -> seq);
+}
@@ -0,0 +1,32 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file shm.h
+ *  Functions exported by shm.c. Programs reading the segment want
+ *  bups_shm.h instead.
+ */
+/*  $Id: shm.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _SHM_H
+#define _SHM_H 1
+
+#include<glib.h>
+#include"ups_connect.h"
+
+extern gboolean shm_open_segment(void);
+extern void     shm_publish(struct UPSData *sample);
+
+#endif /* #ifndef _SHM_H */
@@ -0,0 +1,269 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file stats.c
+ *  Built in instrumentation. The client thread records how long connecting,
+ *  each NUT request and parsing take, how much each read brings in and how
+ *  many records are parsed a second. Reading a sample records how long the
+ *  seqlock was held and waited for, and the UI records the cost of each tick.
+ *
+ *  Everything goes into fixed size log-linear histograms, so recording a 
+ *  value costs a clock read and a few adds and nothing is ever allocated, 
+ *  which is cheap enough to leave on all the time. The summary is shown in 
+ *  the log panel tooltip and the full histograms can be dumped on demand.
+ */
+/*  $Id: stats.c,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#include<glib.h>
+#include<stdio.h>
+#include<time.h>
+#include"stats.h"
+
+static BUPSHistogram stats[STAT_COUNT] =
+{
+    { "connect"  , "us"      },
+    { "rtt"      , "us"      },
+    { "records"  , "per sec" },
+    { "read"     , "bytes"   },
+    { "parse"    , "us"      },
+    { "lock hold", "ns"      },
+    { "lock wait", "ns"      },
+    { "ui tick"  , "us"      },
+    { "alert"    , "us"      }
+};
+
+
+/*****************************************************************************\
+* Bucket arithmetic.                                                          *
+\*****************************************************************************/ 
+
+/** Work out which bucket a value belongs in.
+ */
+static gint bucket_of(guint32 value)
+{
+    guint32 top   = value;
+    gint    shift = 0;
+
+    if(value < STATS_SUB) return value;
+
+    /* find the top bit, the STATS_SUB_BITS below it pick the linear bucket */
+    if(top >> 16) { shift += 16; top >>= 16; }
+    if(top >> 8)  { shift += 8;  top >>= 8;  }
+    if(top >> 4)  { shift += 4;  top >>= 4;  }
+    if(top >> 2)  { shift += 2;  top >>= 2;  }
+    if(top >> 1)  { shift += 1; }
+    shift -= STATS_SUB_BITS;
+
+    return ((shift + 1) << STATS_SUB_BITS) + ((value >> shift) & (STATS_SUB - 1));
+}
+
+
+/** Work out the smallest value that goes in a bucket.
+ */
+static guint32 bucket_low(gint bucket)
+{
+    gint shift = (bucket >> STATS_SUB_BITS) - 1;
+
+    if(bucket < STATS_SUB) return bucket;
+
+    return (guint32)(STATS_SUB | (bucket & (STATS_SUB - 1))) << shift;
+}
+
+
+/** Work out the largest value that goes in a bucket.
+ */
+static guint32 bucket_high(gint bucket)
+{
+    return (bucket == STATS_BUCKETS - 1) ? 0xFFFFFFFFU : bucket_low(bucket + 1) - 1;
+}
+
+
+/*****************************************************************************\
+* Recording.                                                                  *
+\*****************************************************************************/ 
+
+/** Obtain the current time in nanoseconds from the monotonic clock.
+ *  Nanoseconds so the seqlock times, which are a memcpy long, don't all come
+ *  out as 0. Histograms in microseconds are converted by stats_since().
+ */
+gint64 stats_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((gint64)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+
+/** Add a value to a histogram.
+ *
+ *  \par Arguments:
+ *  \arg \c stat - One of the STAT_* values.
+ *  \arg \c value - The value to add, in the unit of the histogram.
+ */
+void stats_record(gint stat, guint32 value)
+{
+    BUPSHistogram *histogram = &stats[stat];
+
+    histogram -> counts[bucket_of(value)]++;
+    histogram -> count++;
+    histogram -> sum += value;
+    if(value > histogram -> max) histogram -> max = value;
+}
+
+
+/** Add the time since start to a histogram.
+ *
+ *  \par Arguments:
+ *  \arg \c stat - One of the STAT_* values.
+ *  \arg \c start - Time the thing being measured started, from stats_now().
+ *  \return The current time, so the end of one measurement can start the next.
+ */
+gint64 stats_since(gint stat, gint64 start)
+{
+    gint64 now     = stats_now();
+    gint64 elapsed = MAX(now - start, 0);
+
+    if(stats[stat].unit[0] == 'u') elapsed /= 1000;
+    stats_record(stat, (guint32)MIN(elapsed, 0xFFFFFFFFU));
+    return now;
+}
+
+
+/** Count things happening for a rate histogram.
+ *  The counts are totalled over STATS_WINDOW and the total recorded when a
+ *  count arrives for the next window. Only windows where something was 
+ *  counted are recorded, so this shows how fast things go while they happen.
+ *
+ *  \par Arguments:
+ *  \arg \c stat - One of the STAT_* values.
+ *  \arg \c count - Number of things that have just happened.
+ */
+void stats_tally(gint stat, guint32 count)
+{
+    BUPSHistogram *histogram = &stats[stat];
+    gint64         now       = stats_now();
+
+    if(histogram -> window && ((now - histogram -> window) >= STATS_WINDOW)) {
+        stats_record(stat, histogram -> tally);
+        histogram -> window = 0;
+    }
+
+    if(!histogram -> window) {
+        histogram -> window = now;
+        histogram -> tally  = 0;
+    }
+    histogram -> tally += count;
+}
+
+
+/*****************************************************************************\
+* Reporting.                                                                  *
+\*****************************************************************************/ 
+
+/** Estimate a percentile of a histogram.
+ *
+ *  \par Arguments:
+ *  \arg \c stat - One of the STAT_* values.
+ *  \arg \c fraction - The percentile wanted, 0.5 for the median, 0.99 for p99.
+ *  \return The top of the bucket the percentile falls in (or the maximum 
+ *  recorded if that is lower), 0 if nothing has been recorded.
+ */
+guint32 stats_percentile(gint stat, gdouble fraction)
+{
+    BUPSHistogram *histogram = &stats[stat];
+    guint64        target, seen = 0;
+    gint           bucket;
+
+    if(!histogram -> count) return 0;
+
+    target = (guint64)(histogram -> count * fraction);
+    if(target >= histogram -> count) target = histogram -> count - 1;
+
+    for(bucket = 0; bucket < STATS_BUCKETS; ++bucket) {
+        seen += histogram -> counts[bucket];
+        if(seen > target) return MIN(bucket_high(bucket), histogram -> max);
+    }
+
+    return histogram -> max;
+}
+
+
+/** Append a value to a report, times are shown in milliseconds or microseconds.
+ */
+static void append_value(GString *text, BUPSHistogram *histogram, guint32 value)
+{
+    if(histogram -> unit[0] == 'u') {
+        g_string_append_printf(text, "%.2fms", value / 1000.0);
+    } else if(histogram -> unit[0] == 'n') {
+        g_string_append_printf(text, "%.2fus", value / 1000.0);
+    } else {
+        g_string_append_printf(text, "%u", value);
+    }
+}
+
+
+/** Append a one line summary of every histogram to a string, for the tooltip.
+ */
+void stats_summary(GString *text)
+{
+    BUPSHistogram *histogram;
+    gint           stat;
+
+    for(stat = 0; stat < STAT_COUNT; ++stat) {
+        histogram = &stats[stat];
+
+        g_string_append_printf(text, "%s%s: ", stat ? "\n" : "", histogram -> name);
+        if(!histogram -> count) {
+            g_string_append(text, "-");
+            continue;
+        }
+
+        g_string_append(text, "p50 ");
+        append_value(text, histogram, stats_percentile(stat, 0.5));
+        g_string_append(text, " p99 ");
+        append_value(text, histogram, stats_percentile(stat, 0.99));
+        g_string_append(text, " max ");
+        append_value(text, histogram, histogram -> max);
+        if(histogram -> unit[1] != 's') g_string_append_printf(text, " %s", histogram -> unit);
+        g_string_append_printf(text, " (%" G_GUINT64_FORMAT ")", histogram -> count);
+    }
+}
+
+
+/** Write every histogram out in full, non-empty buckets only.
+ *
+ *  \par Arguments:
+ *  \arg \c file - Where to write them, eg stderr.
+ */
+void stats_dump(FILE *file)
+{
+    BUPSHistogram *histogram;
+    gint           stat, bucket;
+
+    for(stat = 0; stat < STAT_COUNT; ++stat) {
+        histogram = &stats[stat];
+
+        fprintf(file, "%s (%s): count %" G_GUINT64_FORMAT " sum %" G_GUINT64_FORMAT " max %u\n", 
+                histogram -> name, histogram -> unit, histogram -> count, histogram -> sum, histogram -> max);
+        for(bucket = 0; bucket < STATS_BUCKETS; ++bucket) {
+            if(histogram -> counts[bucket]) {
+                fprintf(file, "    %10u - %10u: %" G_GUINT64_FORMAT "\n", 
+                        bucket_low(bucket), bucket_high(bucket), histogram -> counts[bucket]);
+            }
+        }
+    }
+}
@@ -0,0 +1,74 @@
+/*      __       __
+ *   __/ /_______\ \__     ___ ___ __ _                       _ __ ___ ___
+ *__/ / /  .---.  \ \ \___/                                               \___
+ *_/ | '  /  / /\  ` | \_/          (C) Copyright 2003, Chris Page         \__
+ * \ | |  | / / |  | | / \  Released under the GNU General Public License  /
+ *  >| .  \/ /  /  . |<   >--- --- -- -                       - -- --- ---<
+ * / \_ \  `/__'  / _/ \ /  This program is free software released under   \
+ * \ \__ \_______/ __/ / \   the GNU GPL. Please see the COPYING file in   /
+ *  \  \_         _/  /   \   the distribution archive for more details   /
+ * //\ \__  ___  __/ /\\ //\                                             /
+ *- --\  /_/   \_\  /-- - --\                                           /-----
+ *-----\_/       \_/---------\   ___________________________________   /------
+ *                            \_/                                   \_/
+ */
+/** 
+ *  \file stats.h
+ *  Functions exported by stats.c and the histogram structure.
+ */
+/*  $Id: stats.h,v 1.2 2003/02/06 21:07:53 chris Exp $
+ */
+
+#ifndef _STATS_H
+#define _STATS_H 1
+
+#include<stdio.h>
+#include<glib.h>
+
+#define STATS_SUB_BITS  3    /*!< log2 of the number of linear buckets per power of two.     */
+#define STATS_SUB       (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS   ((32 - STATS_SUB_BITS + 1) << STATS_SUB_BITS) /*!< Buckets covering all of guint32. */
+#define STATS_WINDOW    1000000000 /*!< Nanoseconds stats_tally() counts over.                */
+
+/*! The things measured, indices into the histograms in stats.c. */
+enum
+{
+    STAT_CONNECT = 0,                 /*!< From starting to connect (lookup included) to connected, us. */
+    STAT_RTT,                         /*!< From sending a NUT request to the first line of the reply, us. */
+    STAT_RECORDS,                     /*!< Records or lines parsed in each active second.        */
+    STAT_BYTES,                       /*!< Bytes returned by each read from the server.          */
+    STAT_PARSE,                       /*!< Time to frame and parse each read, us.                */
+    STAT_LOCK_HOLD,                   /*!< Time the client thread holds the sample seqlock, ns.  */
+    STAT_LOCK_WAIT,                   /*!< Time taken (retries included) to read a sample, ns.   */
+    STAT_UI_TICK,                     /*!< Time taken by each bups_update_plugin() or bups_update_samples() call, us. */
+    STAT_ALERT,                       /*!< From reading the data to starting an alert's command, us. */
+    STAT_COUNT
+};
+
+/*! Log-linear histogram.
+ *  Values below STATS_SUB get a bucket each, above that every power of two is
+ *  split into STATS_SUB equal buckets, so any value is known to within 1/STATS_SUB
+ *  with a fixed number of buckets and recording one is a few shifts and adds.
+ *  Each histogram has a single writer, readers may see a value part way in.
+ */
+typedef struct
+{
+    const gchar *name;                /*!< Short name shown in the summary.                      */
+    const gchar *unit;                /*!< "us" or "ns" for times, or the unit counted.           */
+    guint64      counts[STATS_BUCKETS];
+    guint64      count;               /*!< Number of values recorded.                            */
+    guint64      sum;                 /*!< Sum of the values recorded.                           */
+    guint32      max;                 /*!< Largest value recorded.                               */
+    guint32      tally;               /*!< stats_tally() total for the current window.           */
+    gint64       window;              /*!< Start of the current stats_tally() window, 0 if none.  */
+} BUPSHistogram;
+
+extern gint64  stats_now       (void);
+extern void    stats_record    (gint stat, guint32 value);
+extern gint64  stats_since     (gint stat, gint64 start);
+extern void    stats_tally     (gint stat, guint32 count);
+extern guint32 stats_percentile(gint stat, gdouble fraction);
+extern void    stats_summary   (GString *text);
+extern void    stats_dump      (FILE *file);
+
+#endif /* #ifndef _STATS_H */
@@ -75,29 +75,173 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<errno.h>
+#include<time.h>
 #include<sys/types.h>
 #include<unistd.h>
-#include<sys/select.h>
+#include<fcntl.h>
+#include<poll.h>
 #include<sys/socket.h>
+#include<netinet/in.h>
 #include<netdb.h>
+#ifdef __linux__
+#include<sys/inotify.h>
+#endif
 #include"gkrellmbups.h"
 #include"ups_connect.h"
+#include"delta.h"
+#include"shm.h"
+#include"metrics.h"
+#include"stats.h"
+#include"alert.h"
 #include"../config.h"
 
-struct UPSData  ups_status; /*!< Global UPS data structure, must be synchronised across threads! */
-GMutex         *ups_status_lock = NULL; /*!< Synchronisation mutex for ups_status */
-
 static gboolean haltThread = FALSE; /*!< Used to shut down the client thread from gkrellm, set to TRUE to halt then g_thread_join */
+static gint     wakeup[2]  = { -1, -1 }; /*!< Self-pipe polled by the event loop, halt_client() and the resolver write to it to wake the thread */
+static gint     connect_timeout = DEFAULT_CONNECT_TIMEOUT; /*!< Milliseconds allowed for all the connection attempts to a host */
+static gboolean metrics_stale = TRUE;    /*!< TRUE if a sample has been published since the metrics were rendered */
+static UPSNotifyFunc notify_func = NULL; /*!< Called on the main loop after samples are published, see ups_notify() */
+static volatile gint notify_pending = 0; /*!< 1 while a call to notify_func is waiting to run on the main loop */
+static guint    served_taken;            /*!< served.ups_Seq last returned by ups_take_sample().   */
+static gint     pronet_fd   = -1;        /*!< inotify descriptor watching the PRO_NET.DAT directory, -1 if none */
+static gchar   *pronet_name = NULL;      /*!< Name of PRO_NET.DAT within the directory watched */
+
+/* In MODE_GKRELLMD there is no client thread, the samples arrive from the 
+ * gkrellmd server plugin on the GKrellM thread - the only thread that reads them.
+ */
+static gboolean       serving = FALSE;   /*!< TRUE if endpoint 0 is fed by the gkrellmd server plugin. */
+static struct UPSData served;            /*!< Last sample built from the server plugin's updates.       */
+static guint          served_generation; /*!< Number of updates applied to served.                      */
+static guint          served_logs;       /*!< Number of log messages received, used as served.log_Seq.  */
 
 /* Status strings used mainly in ups_connect */
 static const gchar noUPS[]      = "UPS not connected";
 static const gchar gotUPS[]     = "UPS monitoring active";
-static const gchar noMem[]      = "Out of memory";
-static const gchar noSock[]     = "Socket error";
 static const gchar badHost[]    = "Unable to find host";
 static const gchar badConn[]    = "Connection refused";
 static const gchar connLost[]   = "Connection to UPS lost";
-static const gchar disconHost[] = "Disconnecting from server";
+static const gchar noServer[]   = "Waiting for gkrellmd";
+
+
+/*! Client connection states. */
+#define STATE_IDLE        0   /*!< Not connected, the timer says when to try again.      */
+#define STATE_CONNECTING  1   /*!< Non-blocking connect()s in progress, waiting for POLLOUT. */
+#define STATE_CONNECTED   2   /*!< Connected, reading whatever the server sends us.      */
+#define STATE_FAILED      3   /*!< Given up on this endpoint (bad host etc).              */
+#define STATE_RESOLVING   4   /*!< Waiting for the resolver thread to look the host up.  */
+
+#define RECONNECT_DELAY   5000 /*!< Milliseconds to wait between connection attempts.    */
+#define POLL_DELAY        1000 /*!< Milliseconds between NUT polls when things are changing. */
+#define POLL_SLOW         15000 /*!< Longest gap between NUT polls while the UPS is stable. */
+#define POLL_FAST         500  /*!< Gap between NUT polls during a power event.          */
+#define POLL_GUARD        100  /*!< Milliseconds to poll after a change is expected.     */
+#define POLL_BIG_DELTA    5.0  /*!< Change in any value that counts as a power event.    */
+#define MAX_ADDRS         8    /*!< Addresses per host we are willing to try.             */
+#define CONNECT_STAGGER   250  /*!< Milliseconds before racing the next address.          */
+#define RESOLVE_TTL       60000 /*!< Milliseconds to keep the addresses of a host for.    */
+#define READ_BUFSIZE      16384 /*!< Size of the per-client read buffer.                  */
+#define NUT_MAX_VARS      16   /*!< Maximum number of entries in ups_vars[].              */
+
+/*! parse_DeltaUPS() results. */
+#define PARSED_VAL        1   /*!< A VAL record, the sample has new values.               */
+#define PARSED_LOG        2   /*!< A LOG record, only the log message has changed.        */
+
+/** Host lookup handed to a resolver thread.
+ *  getaddrinfo() can block for as long as it likes, so it is run on a thread of
+ *  its own. The lookup is reference counted between the client and the resolver
+ *  so either side can walk away first (halt_client() does not wait for lookups).
+ */
+typedef struct
+{
+    gchar           *host;              /*!< Host to look up.                                        */
+    volatile gint    refs;              /*!< References held by the client and the resolver thread.  */
+    volatile gint    done;              /*!< Non-zero once result and error are valid.               */
+    gint             error;             /*!< getaddrinfo() return code.                              */
+    struct addrinfo *result;            /*!< getaddrinfo() result list.                              */
+} UPSLookup;
+
+/** Per-endpoint client context.
+ *  Everything the client needs to talk to a single upsd or NUT server lives in
+ *  here, so the event loop in ups_start() can look after any number of them 
+ *  from one thread without any of them blocking the others.
+ */
+struct UPSClient
+{
+    gchar          *host;               /*!< Host the server is running on.                          */
+    gint            port;               /*!< Port to connect to.                                     */
+    gint            mode;               /*!< One of the MODE_* values from prefs.h.                  */
+    gchar          *pro_net;            /*!< Location of PRO_NET.DAT (local mode only).              */
+    gint            socket;             /*!< Socket connected to the server, -1 if not connected.    */
+    gint            state;              /*!< One of the STATE_* values above.                        */
+    gint64          timer;              /*!< Monotonic time (ms) of the next timed action, 0 if none. */
+    struct UPSData  work;               /*!< Sample being built, private to the client thread.       */
+    struct UPSData  shared;             /*!< Last published sample, read via ups_read_status().      */
+    volatile gint   seq;                /*!< Sequence lock on shared, odd while it is being updated. */
+    gchar           rbuf[READ_BUFSIZE]; /*!< Data read from the server that has not been framed yet. */
+    gint            rlen;               /*!< Number of bytes in rbuf.                                */
+    struct sockaddr_storage addrs[MAX_ADDRS]; /*!< Addresses obtained for host, IPv6 and IPv4 interleaved. */
+    socklen_t       addr_lens[MAX_ADDRS]; /*!< Length of each entry in addrs.                        */
+    gint            addr_count;         /*!< Number of valid entries in addrs.                       */
+    gint            addr_next;          /*!< Next entry in addrs to try connecting to.               */
+    gint64          addr_expires;       /*!< Monotonic time (ms) at which addrs must be looked up again. */
+    gint            attempts[MAX_ADDRS]; /*!< Sockets of the connect()s racing each other, -1 if unused. */
+    gint64          deadline;           /*!< Monotonic time (ms) at which the connection attempt is abandoned. */
+    UPSLookup      *lookup;             /*!< Host lookup in progress, NULL if none.                  */
+    gchar          *label;              /*!< "host:port" as configured, the metrics endpoint label.  */
+    guint           samples;            /*!< Number of samples published, for the metrics.           */
+    gint64          connect_start;      /*!< stats_now() when ups_connect() started, for STAT_CONNECT. */
+    gint64          received;           /*!< stats_now() when the last data was read, for STAT_ALERT.  */
+    gint            endpoint;           /*!< Index of the client in clients[].                       */
+    struct UPSData  queue[SAMPLE_QUEUE]; /*!< Samples published but not yet taken by ups_take_sample(). */
+    volatile gint   queue_head;         /*!< Samples added to queue, only written by the client thread. */
+    volatile gint   queue_tail;         /*!< Samples taken from queue, only written by the GKrellM thread. */
+    volatile gint   queue_lost;         /*!< Samples that did not fit in the queue, only written by the client thread. */
+    gboolean        queue_full;         /*!< TRUE if the last sample did not fit in the queue.        */
+    gint            lost_seen;          /*!< queue_lost when ups_take_sample() last caught up with it. */
+    guint           taken;              /*!< ups_Seq of the last sample ups_take_sample() returned.   */
+#ifdef ENABLE_NUT
+    gchar          *nut_ups;            /*!< UPS to monitor on a LIST capable server, NULL to ask.   */
+    gboolean        nut_legacy;         /*!< TRUE if the server only speaks LISTVARS/REQ.            */
+    guint           nut_avail;          /*!< Bitmask of the ups_vars[] the server supports (or sent in the last LIST VAR). */
+    gint            nut_pending;        /*!< What the client is waiting for, one of NUT_*.           */
+    gint            nut_queue[NUT_MAX_VARS]; /*!< ups_vars[] indices of the REQs sent this poll, in order. */
+    gint            nut_head;           /*!< Entry in nut_queue the next reply belongs to.           */
+    gint            nut_count;          /*!< Number of REQs sent this poll.                          */
+    gint            nut_interval;       /*!< Current gap between polls (ms), see nut_poll_done().    */
+    gint            nut_period;         /*!< Average time (ms) between changes seen on the server, 0 if unknown. */
+    gint64          nut_changed;        /*!< Monotonic time (ms) the values last changed.            */
+    gboolean        nut_alert;          /*!< TRUE if the last status was on battery/low battery.     */
+    gchar           nut_status[MAX_LINESIZE]; /*!< Flags from the last ups.status, for the metrics.  */
+    gint64          nut_sent;           /*!< Monotonic time (ms) the current poll was sent.          */
+    BUPSLatency     nut_latency;        /*!< Poll round trip times.                                  */
+    gint64          nut_request;        /*!< stats_now() the last request was sent, 0 once answered. */
+#endif
+};
+
+static UPSClient *clients[MAX_ENDPOINTS]; /*!< Endpoints serviced by the client thread.    */
+static gint       client_count = 0;       /*!< Number of valid entries in clients.         */
+
+
+/*! Fields of a VAL record that we know the meaning of (see the file comment),
+ *  the UPSData member each one goes in and the scale to apply to the raw value.
+ */
+static struct
+{
+    gint   field;
+    glong  offset;
+    gfloat scale;
+} val_fields[] =
+{
+    {  5, G_STRUCT_OFFSET(struct UPSData, bat_Voltage), 0.1 },
+    {  7, G_STRUCT_OFFSET(struct UPSData, bat_Level),   0.1 },
+    {  8, G_STRUCT_OFFSET(struct UPSData, in_Freq),     0.1 },
+    {  9, G_STRUCT_OFFSET(struct UPSData, in_Voltage),  0.1 },
+    { 17, G_STRUCT_OFFSET(struct UPSData, out_Freq),    0.1 },
+    { 18, G_STRUCT_OFFSET(struct UPSData, out_Voltage), 0.1 },
+    { 20, G_STRUCT_OFFSET(struct UPSData, ups_Load),    0.1 },
+    { 34, G_STRUCT_OFFSET(struct UPSData, ups_Temp),    0.1 },
+    { -1, 0, 0.0 }
+};
 
 
 #ifdef ENABLE_NUT
@@ -121,38 +265,59 @@ static struct
     {    NULL, NULL }
 };
 
-/*! Variables that are relevant to the plugin, whether the UPS
- *  supports it and the float the variable should go in.
+/*! Variables that are relevant to the plugin, under their old (REQ) and
+ *  current (LIST VAR) names, and the offset of the float in UPSData the 
+ *  variable should go in. Whether an old server supports each one is recorded
+ *  per client in UPSClient.nut_avail.
  */
-/* FIXME: Could be local to ups_client_nut ? */
 static struct 
 {
     gchar    *name;
-    gboolean  avail;
-    gfloat   *var;
+    gchar    *modern;
+    glong     offset;
 } ups_vars[] =
 {
-    {  "STATUS", FALSE, NULL }, /* not handled by read loop */
-    { "UTILITY", FALSE, &ups_status.in_Voltage },
-    { "BATTPCT", FALSE, &ups_status.bat_Level },
-    {  "ACFREQ", FALSE, &ups_status.in_Freq },
-    { "UPSTEMP", FALSE, &ups_status.ups_Temp },
-    { "LOADPCT", FALSE, &ups_status.ups_Load },
-    {"BATTVOLT", FALSE, &ups_status.bat_Voltage },
-    { "OUTVOLT", FALSE, &ups_status.out_Voltage },
-    {      NULL, FALSE, NULL}    
+    {  "STATUS", "ups.status",        -1 }, /* not handled by read loop */
+    { "UTILITY", "input.voltage",     G_STRUCT_OFFSET(struct UPSData, in_Voltage)  },
+    { "BATTPCT", "battery.charge",    G_STRUCT_OFFSET(struct UPSData, bat_Level)   },
+    {  "ACFREQ", "input.frequency",   G_STRUCT_OFFSET(struct UPSData, in_Freq)     },
+    { "UPSTEMP", "ups.temperature",   G_STRUCT_OFFSET(struct UPSData, ups_Temp)    },
+    { "LOADPCT", "ups.load",          G_STRUCT_OFFSET(struct UPSData, ups_Load)    },
+    {"BATTVOLT", "battery.voltage",   G_STRUCT_OFFSET(struct UPSData, bat_Voltage) },
+    { "OUTVOLT", "output.voltage",    G_STRUCT_OFFSET(struct UPSData, out_Voltage) },
+    {      NULL, NULL,                -1 }    
 };
 
-#define VAR_STATUS 0
+/*! Variables only available from LIST VAR (there is no REQ name for them). */
+static struct
+{
+    gchar    *modern;
+    glong     offset;
+} modern_vars[] =
+{
+    { "output.frequency", G_STRUCT_OFFSET(struct UPSData, out_Freq) },
+    { NULL, -1 }
+};
 
-#endif
+/*! Values compared between polls by the poll scheduler. */
+static const glong compare_offsets[] = 
+{
+    G_STRUCT_OFFSET(struct UPSData, in_Voltage),  G_STRUCT_OFFSET(struct UPSData, out_Voltage),
+    G_STRUCT_OFFSET(struct UPSData, in_Freq),     G_STRUCT_OFFSET(struct UPSData, out_Freq),
+    G_STRUCT_OFFSET(struct UPSData, bat_Voltage), G_STRUCT_OFFSET(struct UPSData, bat_Level),
+    G_STRUCT_OFFSET(struct UPSData, ups_Load),    G_STRUCT_OFFSET(struct UPSData, ups_Temp),
+    -1
+};
 
-/* Globals used to simplify thread startup code.
- */
-static gchar *pro_net_loc = NULL;
-static gchar *ups_host    = NULL;
-static gint   ups_port;
-static gint   ups_mode;
+#define VAR_STATUS    0
+
+#define NUT_IDLE     -1  /*!< No request outstanding.                */
+#define NUT_LISTVARS -2  /*!< Waiting for the LISTVARS reply.         */
+#define NUT_POLLING  -3  /*!< Waiting for the replies to a poll.      */
+#define NUT_LISTUPS  -4  /*!< Waiting for the LIST UPS reply.         */
+#define NUT_LISTVAR  -5  /*!< Waiting for the LIST VAR reply to a poll. */
+
+#endif
 
 
 /*****************************************************************************\
@@ -172,15 +337,17 @@ gint process_pronet(gchar *filename)
 
     if(strlen(filename)) {
         if((pronet = fopen(filename, "r")) != NULL) {
+            *buffer = '\0';
             fgets(buffer, MAX_PRONET, pronet); /* read the first line (master/slave) */
-            fgets(buffer, MAX_PRONET, pronet); /* this is the line we want - the port */
+            if(!fgets(buffer, MAX_PRONET, pronet)) *buffer = '\0'; /* this is the line we want - the port */
+            fclose(pronet);
+
             if((*buffer != '\n') && (*buffer != '\0')) {
                 value = strtol(buffer, &remain, 0);
                 if(remain != buffer) {
                     return value;
                 }
             }
-            fclose(pronet);
         }
     }
 
@@ -188,6 +355,19 @@ gint process_pronet(gchar *filename)
 }
 
 
+/** Obtain the current time in milliseconds from the monotonic clock.
+ *  All the client timers use this so that they are unaffected by changes
+ *  to the system clock.
+ */
+static gint64 now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((gint64)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+
 /** Clear the specified UPSData structure. 
  *  Use this to zero all the fields of a UPSData structure. Mainly intended to 
  *  simplify the initialisation of static structures.
@@ -204,6 +384,9 @@ static void reset_status(struct UPSData *target)
     target -> ups_Temp    = 0.0;
     target -> ups_LastLog[0] = '\0';
     target -> ups_Present = FALSE;
+    target -> ups_Valid   = FALSE;
+    target -> ups_Lost    = FALSE;
+    target -> val_Count   = 0;
 }
 
 
@@ -228,31 +411,286 @@ static void set_last_log(struct UPSData *target, const gchar *log)
 }
 
 
-/** Traverse string until a number of tabs have been encountered.
- *  The data generated by the upsd service is basically tab separated and
- *  most of the fields in the data appear to serve no purpose. This
- *  function allows a number of tabs to be skipped in one go, reducing
- *  the amount of waffle needed in parseVAL().
+
+/** Main loop idle callback that tells the UI about new samples.
+ *  notify_pending is cleared before the UI looks at the samples, so one 
+ *  published while it is doing so schedules another call.
+ */
+static gboolean notify_idle(gpointer data)
+{
+    g_atomic_int_compare_and_exchange(&notify_pending, 1, 0);
+    if(notify_func) notify_func();
+
+    return FALSE;
+}
+
+
+/** Arrange for notify_func to be called on the main loop.
+ *  g_idle_add() wakes the main loop up, so new samples are seen straight
+ *  away rather than at the next GKrellM tick. Samples published before the
+ *  call has run are all picked up by it, only one call is ever queued.
+ */
+static void notify_schedule(void)
+{
+    if(notify_func && g_atomic_int_compare_and_exchange(&notify_pending, 0, 1)) {
+        g_idle_add(notify_idle, NULL);
+    }
+}
+
+
+/** Set the function to call when new samples have been published.
+ *  The function is called on the thread running the default main loop (the
+ *  GKrellM thread) and should take the samples of every endpoint it is 
+ *  interested in with ups_take_sample(), as one call may cover several 
+ *  samples from several endpoints. Samples are only queued while there is
+ *  a notify function, the gkrellmd server plugin just wants the latest.
+ *
+ *  \par Arguments:
+ *  \arg \c func - Function to call, NULL to stop calling it.
+ */
+void ups_notify(UPSNotifyFunc func)
+{
+    notify_func = func;
+}
+
+
+/** Publish the client's working sample so the UI can see it.
+ *  The client thread never holds a lock while it is talking to the server, it
+ *  builds each sample in its private work structure and copies the finished
+ *  article into shared under a sequence lock. The sequence is odd while the
+ *  copy is in progress, so readers can tell when they need to try again.
+ *  A new log message gets a new log_Seq, so the UI only has to look at the
+ *  message when it has changed. Alert rules are checked before the sample is
+ *  published, see alert.c.
+ *
+ *  If the UI wants every sample (see ups_notify()) and this one carries new
+ *  values (a VAL record, a completed poll or the sample saying they have been
+ *  lost) a copy is also added to the client's queue, a ring with a single
+ *  producer (this thread) and a single consumer (ups_take_sample() on the
+ *  GKrellM thread). Each side only writes its own counter, so neither ever
+ *  waits for the other. When the UI falls SAMPLE_QUEUE samples behind new
+ *  ones are only counted, once it has caught up ups_take_sample() hands it
+ *  the latest one from shared instead.
+ *  Log messages and connection progress only go to shared, where the UI
+ *  picks them up by log_Seq - queued, they would be chart columns and 
+ *  history records that don't stand for any time passing.
+ *
+ *  \par Arguments:
+ *  \arg \c client - The client whose work structure should be published.
+ *  \arg \c sample - TRUE if the work structure has new values for the queue.
+ */
+static void client_publish(UPSClient *client, gboolean sample)
+{
+    const gchar *status = NULL;
+    gint64       start;
+    gint         head;
+
+    /* shared is only written by this thread, so it can be read without the lock */
+    if(strcmp(client -> work.ups_LastLog, client -> shared.ups_LastLog)) {
+        client -> work.log_Seq = client -> shared.log_Seq + 1;
+    }
+    client -> work.ups_Seq = client -> shared.ups_Seq + (sample ? 1 : 0);
+    client -> work.ups_Time  = time(NULL);
+    client -> work.ups_Stamp = now_ms();
+
+    /* alerts first, they are what the user is waiting for */
+#ifdef ENABLE_NUT
+    if(client -> mode == MODE_NUT) status = client -> nut_status;
+#endif
+    alert_evaluate(client -> endpoint, &client -> work, status, client -> received);
+
+    start = stats_now();
+    g_atomic_int_inc(&client -> seq);
+    memcpy(&client -> shared, &client -> work, sizeof(struct UPSData));
+    g_atomic_int_inc(&client -> seq);
+    stats_since(STAT_LOCK_HOLD, start);
+
+    client -> samples++;
+    metrics_stale = TRUE;
+
+    if(notify_func && sample) {
+        head = client -> queue_head;
+        if((guint)(head - g_atomic_int_get(&client -> queue_tail)) < SAMPLE_QUEUE) {
+            memcpy(&client -> queue[head & (SAMPLE_QUEUE - 1)], &client -> work, sizeof(struct UPSData));
+            g_atomic_int_inc(&client -> queue_head); /* a full barrier, the copy is visible first */
+            client -> queue_full = FALSE;
+        } else {
+            /* shared already has this sample, which is all ups_take_sample() needs */
+            g_atomic_int_inc(&client -> queue_lost);
+            if(!client -> queue_full) {
+                fprintf(stderr, "client_publish: %s: GKrellM has not taken the last %d samples, charting a gap\n",
+                        client -> label, SAMPLE_QUEUE);
+                client -> queue_full = TRUE;
+            }
+        }
+    }
+    notify_schedule();
+
+    /* local tools read the first endpoint from shared memory, see shm.c */
+    if(client == clients[0]) shm_publish(&client -> work);
+}
+
+
+/** Obtain a consistent copy of the last sample published by an endpoint.
+ *  This never blocks - if the client thread is part way through publishing a
+ *  sample the copy is simply retried, and that only takes as long as a memcpy.
+ *
+ *  \par Arguments:
+ *  \arg \c endpoint - Index of the endpoint, 0 is the server selected in the config.
+ *  \arg \c dest - UPSData structure to copy the sample into.
+ *  \return The generation of the sample (the number of samples the endpoint has
+ *  published), or 0 if there is no such endpoint.
+ */
+guint ups_read_status(gint endpoint, struct UPSData *dest)
+{
+    UPSClient *client;
+    gint       seq;
+    gint64     start;
+
+    if(serving && (endpoint == 0)) {
+        memcpy(dest, &served, sizeof(struct UPSData));
+        return served_generation;
+    }
+
+    if((endpoint < 0) || (endpoint >= client_count)) {
+        reset_status(dest);
+        return 0;
+    }
+
+    client = clients[endpoint];
+    start  = stats_now();
+    do {
+        seq = g_atomic_int_get(&client -> seq);
+        memcpy(dest, &client -> shared, sizeof(struct UPSData));
+    } while((seq & 1) || (seq != g_atomic_int_get(&client -> seq)));
+    stats_since(STAT_LOCK_WAIT, start);
+
+    return seq / 2;
+}
+
+
+/** Take the oldest sample an endpoint has queued for the UI.
+ *  Only the GKrellM thread may call this. If samples were dropped because the
+ *  queue was full, the latest published sample is returned once the queue is
+ *  empty, so the UI is never left behind. Samples are numbered by ups_Seq, 
+ *  any that were skipped set ups_Lost in the next one returned and a sample
+ *  already returned is never returned again. In MODE_GKRELLMD the server 
+ *  plugin's samples are applied on the GKrellM thread, so there is no queue
+ *  and the latest sample is returned if there has been an update since the
+ *  last call.
+ *
+ *  \par Arguments:
+ *  \arg \c endpoint - Index of the endpoint, 0 is the server selected in the config.
+ *  \arg \c dest - UPSData structure to copy the sample into.
+ *  \return TRUE if a sample was copied into dest, FALSE if there are none waiting.
+ */
+gboolean ups_take_sample(gint endpoint, struct UPSData *dest)
+{
+    UPSClient *client;
+    gint       tail, lost;
+
+    if(serving && (endpoint == 0)) {
+        if(served_taken == served.ups_Seq) return FALSE;
+        served_taken = served.ups_Seq;
+        memcpy(dest, &served, sizeof(struct UPSData));
+        return TRUE;
+    }
+
+    if((endpoint < 0) || (endpoint >= client_count)) return FALSE;
+
+    client = clients[endpoint];
+    do {
+        tail = client -> queue_tail;
+        if(tail != g_atomic_int_get(&client -> queue_head)) {
+            memcpy(dest, &client -> queue[tail & (SAMPLE_QUEUE - 1)], sizeof(struct UPSData));
+            g_atomic_int_inc(&client -> queue_tail); /* the slot can only be reused once the copy is done */
+        } else if((lost = g_atomic_int_get(&client -> queue_lost)) != client -> lost_seen) {
+            /* caught up after dropping samples, the latest is in shared */
+            client -> lost_seen = lost;
+            ups_read_status(endpoint, dest);
+        } else {
+            return FALSE;
+        }
+    } while((gint)(dest -> ups_Seq - client -> taken) <= 0);
+
+    dest -> ups_Lost = client -> taken && (dest -> ups_Seq != client -> taken + 1);
+    client -> taken  = dest -> ups_Seq;
+
+    return TRUE;
+}
+
+
+/** Apply an update line from the gkrellmd server plugin.
+ *  This is connected to the server plugin's data with 
+ *  gkrellm_client_plugin_serve_data_connect(), so it is called on the GKrellM
+ *  thread whenever gkrellmd sends a line of UPS data.
+ */
+void ups_serve_input(gchar *line)
+{
+    if(serving && delta_decode(&served, line)) {
+        /* log messages are numbered here, the server's numbers restart with gkrellmd */
+        if(*line == 'l') served.log_Seq = ++served_logs;
+        else ++served.ups_Seq;
+        if(++served_generation == 0) served_generation = 1;
+        served.ups_Time  = time(NULL);
+        served.ups_Stamp = now_ms();
+        notify_schedule();
+    }
+}
+
+
+/** Close the connection to the server.
+ *  Closes the client socket (if open) and any connections still racing, 
+ *  optionally clears the status structure and sets the log to the specified
+ *  message. The client is left idle, the caller says when to connect again.
  *
  *  \par Arguments:
- *  \arg \c str - String to be processed.
- *  \arg \c count - Number of tags to skip.
- *  \return A pointer to the character after the last tab skipped, or the
- *  end of the string (if the string ended before enough tabs had been
- *  skipped.
+ *  \arg \c client - The client to close.
+ *  \arg \c log - Message to leave in ups_LastLog, or NULL to leave the status alone.
  */
-static gchar *skip_tabs(gchar *str, gint count)
+static void client_close(UPSClient *client, const gchar *log)
 {
-    while(*str && count) {
-        while(*str && (*str != '\t')) {
-            str ++;
+    gint     attempt;
+    gboolean sampled;
+
+    if(client -> socket >= 0) {
+        close(client -> socket);
+        client -> socket = -1;
+    }
+
+    for(attempt = 0; attempt < MAX_ADDRS; ++attempt) {
+        if(client -> attempts[attempt] >= 0) {
+            close(client -> attempts[attempt]);
+            client -> attempts[attempt] = -1;
         }
+    }
 
-        /* skip the tab we are over..*/
-        if(*str == '\t') str++;
-        count --;
+    if(log) {
+        /* one invalid sample marks the loss, retries that fail again add nothing */
+        sampled = client -> shared.ups_Valid;
+        reset_status(&client -> work);
+        set_last_log(&client -> work, log);
+        client_publish(client, sampled);
     }
-    return str;
+
+    client -> rlen   = 0;
+    client -> state  = STATE_IDLE;
+}
+
+
+/** Drop a failed connection to the server and arrange for a reconnect.
+ *  Closes the connection with client_close(), then sets the timer so the 
+ *  event loop will try to connect again after RECONNECT_DELAY.
+ *
+ *  \par Arguments:
+ *  \arg \c client - The client to disconnect.
+ *  \arg \c log - Message to leave in ups_LastLog, or NULL to leave the status alone.
+ */
+static void client_disconnect(UPSClient *client, const gchar *log)
+{
+    fprintf(stderr, "ups_start: %s:%d failed. Sleeping\n", client -> host, client -> port);
+    client_close(client, log);
+    client -> timer  = now_ms() + RECONNECT_DELAY;
 }
 
 
@@ -263,157 +701,438 @@ static gchar *skip_tabs(gchar *str, gint count)
 \*****************************************************************************/ 
 
 /** Sends a command string to the socket. Hopefully there is a nut server on
- *  the other end of the socket, if so this will take the reply, null
- *  terminate it and return the number of bytes read.
+ *  the other end of the socket, the reply will be picked up by the event loop
+ *  and passed to nut_process_line() when it arrives.
  *
  *  \par Arguments:
+ *  \arg \c client - The client whose server the command should be sent to.
  *  \arg \c command - The command to send to the server.
  *  \arg \c variable - The variable to include in the command string (for REQ).
  *                     Set to NULL if the command needs no variable (LISTVARS).
- *  \arg \c buffer - the buffer used to construct the command and store the result.
- *  \arg \c bufferlen - length of the buffer.
+ *  \return The number of bytes written, or -1 on error.
  */
-static gint send_nut_command(gchar *command, gchar *variable, gchar *buffer, gint bufferlen)
+static gint send_nut_command(UPSClient *client, gchar *command, gchar *variable)
 {
-    gint size;
+    gchar buffer[MAX_PRONET];
+    gint  size;
 
-    /* send the request */
     if(variable) {
-        size = g_snprintf(buffer, bufferlen, "%s %s\r\n", command, variable);
+        size = g_snprintf(buffer, sizeof(buffer), "%s %s\r\n", command, variable);
     } else {
-        size = g_snprintf(buffer, bufferlen, "%s\r\n", command);
+        size = g_snprintf(buffer, sizeof(buffer), "%s\r\n", command);
     }
-    write(ups_status.ups_Socket, buffer, size);
-    
-    /* check before we go into a block... */
-    if(haltThread) return 0;
 
-    /* FIXME: this is not guaranteed to fetch a line properly in all situations. */
-    size = read(ups_status.ups_Socket, buffer, bufferlen);
-    buffer[size] = '\0';
-    
-    return size;
+    client -> nut_request = stats_now();
+    return write(client -> socket, buffer, size);
 }
 
 
-/** Request a number from the server. Really a wrapper to send_nut_command that
- *  does some post-processing of the reply to deal with errors and convert the
- *  number at the end of the reply string into a float.
+/** Work out which ups_vars[] entry a reply refers to.
+ *  Replies to REQ take the form "ANS <variable> <value>", this finds the 
+ *  variable in ups_vars[] and the start of the value.
+ *
+ *  \par Arguments:
+ *  \arg \c buffer - The reply line.
+ *  \arg \c value - Set to point at the value in buffer if the variable was found.
+ *  \return The ups_vars[] index of the variable, or -1 if the line is not an answer 
+ *  to a variable we know about (ERR lines for example).
  */
-static gint request_nut_float(gchar *variable, float *result, gchar *buffer, gint bufferlen)
+static gint nut_parse_answer(gchar *buffer, gchar **value)
 {
-    gint size;
-    gchar *value;
+    gint variable;
+    gint len;
 
-    size = send_nut_command("REQ", variable, buffer, bufferlen);
-    
-    if(size > -1) {
-        /* not an error? */
-        if(strncmp(buffer, "ERR", 3)) {
-            /* value is at "ANS "<variable>" " */
-            value = buffer + 5 + strlen(variable);
-            *result = (float)strtod(value, NULL);
+    if(strncmp(buffer, "ANS ", 4)) return -1;
+    buffer += 4;
+
+    for(variable = 0; ups_vars[variable].name; ++variable) {
+        len = strlen(ups_vars[variable].name);
+        if(!strncmp(buffer, ups_vars[variable].name, len) && (buffer[len] == ' ')) {
+            *value = buffer + len + 1;
+            return variable;
         }
-        return size;
     }
 
     return -1;
 }
 
 
-/** Request a the current status of the UPS. Does post-processing of a REQ STATUS
- *  sent to NUT via send_nut_command to replace the short status string returned
- *  by NUT with a sensible human-readable equivalent.
+/** Process the value from a REQ for a number. Converts the number into a float
+ *  stored at the location in the client status that ups_vars[] says it belongs in.
  */
-static gint request_nut_status(gchar *buffer, gint bufferlen)
+static void request_nut_float(UPSClient *client, gint variable, gchar *value)
 {
-    gint size;
-    gint row  = 0;
-    gchar *result;
-
-    size = send_nut_command("REQ", "STATUS", buffer, bufferlen);
-
-    if(size > -1) {
-        if(strncmp(buffer, "ERR", 3)) { 
-            /* result is after "ANS STATUS " */
-            result = buffer + 11;
-
-            /* compare with contents of status_texts[] to obtain a human-readable form ... */
-            while(status_texts[row].name) {
-                if(!strncmp(result, status_texts[row].name, strlen(status_texts[row].name))) {
-                    /* set status... */
-                    set_last_log(&ups_status, status_texts[row].log);
-                    ups_status.ups_Present = TRUE;
-                    return size;
-                }
-                ++row;
+    *(gfloat *)((gchar *)&client -> work + ups_vars[variable].offset) = (gfloat)strtod(value, NULL);
+    client -> work.ups_Valid = TRUE;
+}
+
+
+/** Process the value from a REQ STATUS, replacing the short status string
+ *  returned by NUT with a sensible human-readable equivalent.
+ *
+ *  \par Arguments:
+ *  \arg \c client - The client the reply was received by.
+ *  \arg \c result - The status string, NULL if the server returned an error.
+ */
+static void request_nut_status(UPSClient *client, gchar *result)
+{
+    gint   row  = 0;
+    gchar *flag;
+    gint   len;
+
+    /* any OB/LB/FSD flag in the status makes the scheduler poll fast */
+    client -> nut_alert = FALSE;
+    g_strlcpy(client -> nut_status, result ? result : "", sizeof(client -> nut_status));
+    for(flag = result; flag && *flag; flag += len) {
+        while(*flag == ' ') ++flag;
+        len = strcspn(flag, " ");
+        if(((len == 2) && (!strncmp(flag, "OB", 2) || !strncmp(flag, "LB", 2))) ||
+           ((len == 3) && !strncmp(flag, "FSD", 3))) {
+            client -> nut_alert = TRUE;
+        }
+    }
+
+    if(result) { 
+        /* compare with contents of status_texts[] to obtain a human-readable form ... */
+        while(status_texts[row].name) {
+            if(!strncmp(result, status_texts[row].name, strlen(status_texts[row].name))) {
+                /* set status... */
+                set_last_log(&client -> work, status_texts[row].log);
+                client -> work.ups_Present = TRUE;
+                return;
             }
-            
+            ++row;
         }
-        /* error or unknown status.. assume something bad has happened... */
-        set_last_log(&ups_status, noUPS);
-        ups_status.ups_Present = FALSE;
-        return size;
     }
 
-    return -1;
+    /* error or unknown status.. assume something bad has happened... */
+    set_last_log(&client -> work, noUPS);
+    client -> work.ups_Present = FALSE;
+    client -> work.ups_Valid   = FALSE;
 }
 
 
-/** Read data from a NUT server and place the data in the ups_status structure.
- *  This client asks the NUT server for a list of supported variables and then enters a loop 
- *  reading each one of the available arguments in turn using the request_nut_* functions.
+/** Parse a "VAR <ups> <name> "<value>"" line from a LIST VAR reply.
+ *  The value is unquoted in place.
  *
  *  \par Arguments:
- *  \arg \c acc - buffer to use as an accumulator, must be at least MAX_LINESIZE characters in length.
- *  \arg \c temp - buffer to use as temporary store, again must be MAX_LINESIZE or greater.
- *  \return 0 on clean exit, 1 on forced, -1 if connection lost.
+ *  \arg \c buffer - The reply line.
+ *  \arg \c value - Set to point at the unquoted value.
+ *  \return The name of the variable, or NULL if the line is not a VAR line.
+ */
+static gchar *nut_parse_var(gchar *buffer, gchar **value)
+{
+    gchar *name, *end;
+
+    if(strncmp(buffer, "VAR ", 4)) return NULL;
+
+    /* skip the ups name */
+    if((name = strchr(buffer + 4, ' ')) == NULL) return NULL;
+    ++name;
+
+    if((end = strchr(name, ' ')) == NULL) return NULL;
+    *end++ = '\0';
+
+    if(*end == '"') ++end;
+    *value = end;
+    if((end = strrchr(end, '"')) != NULL) *end = '\0';
+
+    return name;
+}
+
+
+/** Store a variable from a LIST VAR reply in the client status.
  */
-static int ups_client_nut(gchar *acc, gchar *temp)
+static void nut_store_var(UPSClient *client, gchar *name, gchar *value)
 {
-    gint size, readerr = 0;
     gint variable;
 
-    size = send_nut_command("LISTVARS", NULL, temp, MAX_LINESIZE);
-
-    if(size) {
-        /* pase the variable list for the features we have... */
-        variable = 0;
-        while(ups_vars[variable].name) {
-            ups_vars[variable].avail = (strstr(temp, ups_vars[variable].name) != NULL);
-            ++variable;
-        }
-    
-        /* stop now? */
-        while(!haltThread && (readerr >= 0)) {
-            sleep(1);
-            g_mutex_lock(ups_status_lock);
-
-            variable = 0;
-            readerr  = 0;
-            /* process all available float type variables */
-            while(!haltThread && ups_vars[variable].name && (readerr >= 0)) {
-                if(ups_vars[variable].avail && ups_vars[variable].var) {
-                    readerr = request_nut_float(ups_vars[variable].name, ups_vars[variable].var, temp, MAX_LINESIZE);
-                }
-                ++variable;
+    for(variable = 0; ups_vars[variable].name; ++variable) {
+        if(!strcmp(name, ups_vars[variable].modern)) {
+            if(variable == VAR_STATUS) {
+                request_nut_status(client, value);
+                client -> nut_avail |= (1 << VAR_STATUS);
+            } else {
+                request_nut_float(client, variable, value);
             }
+            return;
+        }
+    }
 
-            /* status has to be handled specially... */
-            if(ups_vars[VAR_STATUS].avail) {
-               readerr = request_nut_status(temp, MAX_LINESIZE);
-            }
-            g_mutex_unlock(ups_status_lock);            
-        } /* while(!haltThread) */
+    for(variable = 0; modern_vars[variable].modern; ++variable) {
+        if(!strcmp(name, modern_vars[variable].modern)) {
+            *(gfloat *)((gchar *)&client -> work + modern_vars[variable].offset) = (gfloat)strtod(value, NULL);
+            client -> work.ups_Valid = TRUE;
+            return;
+        }
     }
-     
-    if(haltThread) return 1;
+}
 
-    return 0;
+
+/** Give up on the LIST commands and talk to the server the old way.
+ */
+static void nut_use_legacy(UPSClient *client)
+{
+    fprintf(stderr, "ups_connect: %s does not support LIST, using LISTVARS\n", client -> host);
+
+    client -> nut_legacy  = TRUE;
+    client -> nut_pending = NUT_LISTVARS;
+    if(send_nut_command(client, "LISTVARS", NULL) < 0) {
+        client_disconnect(client, connLost);
+    }
 }
 
-#endif /* #ifdef ENABLE_NUT */
 
+/** Add a REQ for the specified variable to a poll.
+ *  The request is appended to the command buffer and the variable is recorded
+ *  in the client queue so that the reply can be matched up with it later.
+ */
+static void nut_queue_request(UPSClient *client, gint variable, gchar *buffer, gint *size)
+{
+    *size += g_snprintf(buffer + *size, MAX_LINESIZE - *size, "REQ %s\r\n", ups_vars[variable].name);
+    client -> nut_queue[client -> nut_count++] = variable;
+}
+
+
+/** Start a poll of the NUT server. Called from the event loop when the client
+ *  timer expires on a connected NUT client. 
+ *  Every REQ for the poll is sent in a single write, the server answers them
+ *  in order and the replies are matched back up by nut_process_line() as they
+ *  stream in - so a poll costs one round trip however many variables there are.
+ */
+static void nut_start_poll(UPSClient *client)
+{
+    gchar buffer[MAX_LINESIZE];
+    gint  size = 0;
+    gint  variable;
+
+    if(client -> nut_pending != NUT_IDLE) return;
+
+    /* only values received during this poll count */
+    client -> work.ups_Valid = FALSE;
+
+    /* current servers hand everything over in one LIST VAR */
+    if(!client -> nut_legacy) {
+        /* status must turn up again for the UPS to count as present */
+        client -> nut_avail   = 0;
+        client -> nut_pending = NUT_LISTVAR;
+        client -> nut_sent    = now_ms();
+        if(send_nut_command(client, "LIST VAR", client -> nut_ups) < 0) {
+            client_disconnect(client, connLost);
+        }
+        return;
+    }
+
+    client -> nut_head  = 0;
+    client -> nut_count = 0;
+
+    /* process all available float type variables */
+    for(variable = 0; ups_vars[variable].name; ++variable) {
+        if((client -> nut_avail & (1 << variable)) && (ups_vars[variable].offset >= 0)) {
+            nut_queue_request(client, variable, buffer, &size);
+        }
+    }
+
+    /* status has to be handled specially... */
+    if(client -> nut_avail & (1 << VAR_STATUS)) {
+        nut_queue_request(client, VAR_STATUS, buffer, &size);
+    }
+
+    if(!client -> nut_count) {
+        client -> timer = now_ms() + POLL_DELAY;
+        return;
+    }
+
+    client -> nut_pending = NUT_POLLING;
+    client -> nut_sent    = now_ms();
+    client -> nut_request = stats_now();
+    if(write(client -> socket, buffer, size) != size) {
+        client_disconnect(client, connLost);
+    }
+}
+
+
+/** Publish a completed poll and work out when to poll again.
+ *  While the UPS is on line and nothing much is changing the gap between polls
+ *  doubles up to POLL_SLOW. As soon as the UPS goes on battery or a value 
+ *  jumps by POLL_BIG_DELTA or more polling drops to POLL_FAST, aligned (when
+ *  we know it) to just after the server is next expected to have new values.
+ *  The server's update period is an average of the gaps between changes, only
+ *  measured while polling quickly as slow polls would just measure themselves.
+ */
+static void nut_poll_done(UPSClient *client)
+{
+    gint64   now     = now_ms();
+    gboolean changed = FALSE, big = FALSE;
+    gfloat   delta;
+    gint     variable, period;
+    glong    offset;
+
+    for(variable = 0; (offset = compare_offsets[variable]) >= 0; ++variable) {
+        delta  = *(gfloat *)((gchar *)&client -> work   + offset) - 
+                 *(gfloat *)((gchar *)&client -> shared + offset);
+        if(delta != 0.0) changed = TRUE;
+        if((delta >= POLL_BIG_DELTA) || (delta <= -POLL_BIG_DELTA)) big = TRUE;
+    }
+    if(strcmp(client -> work.ups_LastLog, client -> shared.ups_LastLog)) changed = big = TRUE;
+
+    metrics_observe(&client -> nut_latency, now - client -> nut_sent);
+    client_publish(client, TRUE);
+    client -> nut_pending = NUT_IDLE;
+
+    if(changed) {
+        if(client -> nut_changed && (client -> nut_interval <= POLL_DELAY)) {
+            period = (gint)(now - client -> nut_changed);
+            client -> nut_period = client -> nut_period ? ((client -> nut_period * 7) + period) / 8 : period;
+        }
+        client -> nut_changed = now;
+    }
+
+    if(client -> nut_alert || big) {
+        client -> nut_interval = POLL_FAST;
+        if(client -> nut_period >= POLL_FAST) {
+            /* next expected change after now, plus a little for the server to catch up */
+            client -> timer = client -> nut_changed + POLL_GUARD + 
+                              (((now - client -> nut_changed) / client -> nut_period) + 1) * client -> nut_period;
+            return;
+        }
+    } else {
+        client -> nut_interval = MIN(MAX(client -> nut_interval * 2, POLL_DELAY), POLL_SLOW);
+    }
+
+    client -> timer = now + client -> nut_interval;
+}
+
+
+/** Handle a single line received from a NUT server.
+ *  LIST replies are multi-line, bracketed by "BEGIN LIST ..." and 
+ *  "END LIST ..." lines, the END line completes the request. An error in 
+ *  reply to LIST UPS, or UNKNOWN-COMMAND to LIST VAR, means an old server
+ *  so the client drops back to LISTVARS/REQ.
+ *
+ *  During a legacy poll each line is the reply to the oldest request in the
+ *  client queue. Answers are matched to ups_vars[] by name (so an out of step
+ *  reply still goes in the right place), errors consume the oldest request. 
+ *  Once every reply is in, the next poll is scheduled.
+ */
+static void nut_process_line(UPSClient *client, gchar *line)
+{
+    gint   variable;
+    gchar *value = NULL;
+    gchar *name;
+
+    if(client -> nut_request) {
+        stats_since(STAT_RTT, client -> nut_request);
+        client -> nut_request = 0;
+    }
+
+    switch(client -> nut_pending) {
+        case NUT_LISTUPS:  if(!strncmp(line, "ERR ", 4)) {
+                               nut_use_legacy(client);
+                           } else if(!strncmp(line, "UPS ", 4) && !client -> nut_ups) {
+                               /* no UPS configured, monitor the first one the server has */
+                               if((name = strchr(line + 4, ' ')) != NULL) *name = '\0';
+                               client -> nut_ups = g_strdup(line + 4);
+                           } else if(!strncmp(line, "END LIST", 8)) {
+                               if(client -> nut_ups) {
+                                   client -> nut_pending = NUT_IDLE;
+                                   client -> timer = 1;
+                               } else {
+                                   nut_use_legacy(client);
+                               }
+                           }
+                           break;
+
+        case NUT_LISTVAR:  if((name = nut_parse_var(line, &value)) != NULL) {
+                               nut_store_var(client, name, value);
+                           } else if(!strncmp(line, "ERR UNKNOWN-COMMAND", 19)) {
+                               nut_use_legacy(client);
+                           } else if(!strncmp(line, "END LIST", 8) || !strncmp(line, "ERR ", 4)) {
+                               if(!strncmp(line, "ERR ", 4)) client -> work.ups_Valid = FALSE;
+                               if(!(client -> nut_avail & (1 << VAR_STATUS))) {
+                                   request_nut_status(client, NULL);
+                               }
+                               /* the status may have come before values that set ups_Valid again */
+                               if(!client -> work.ups_Present) client -> work.ups_Valid = FALSE;
+                               nut_poll_done(client);
+                           }
+                           break;
+
+        case NUT_LISTVARS: /* parse the variable list for the features we have... */
+                           client -> nut_avail = 0;
+                           for(variable = 0; ups_vars[variable].name; ++variable) {
+                               if(strstr(line, ups_vars[variable].name) != NULL) {
+                                   client -> nut_avail |= (1 << variable);
+                               }
+                           }
+                           client -> nut_pending = NUT_IDLE;
+                           client -> timer = now_ms() + POLL_DELAY;
+                           break;
+
+        case NUT_POLLING:  if((variable = nut_parse_answer(line, &value)) < 0) {
+                               variable = client -> nut_queue[client -> nut_head];
+                           }
+
+                           if(variable == VAR_STATUS) {
+                               request_nut_status(client, value);
+                           } else if(value) {
+                               request_nut_float(client, variable, value);
+                           }
+
+                           ++client -> nut_head;
+                           if(client -> nut_head >= client -> nut_count) {
+                               /* poll complete, let the world see it */
+                               nut_poll_done(client);
+                           }
+                           break;
+
+        default:           /* unsolicited, ignore it */
+                           break;
+    }
+}
+
+
+/** Split the data read from a NUT server into lines for nut_process_line().
+ *  Lines are terminated in place in the client read buffer and whatever is
+ *  left of an incomplete line is moved to the start of the buffer to wait
+ *  for the rest of it.
+ *
+ *  \return The number of lines processed.
+ */
+static gint nut_frame(UPSClient *client)
+{
+    gchar *start = client -> rbuf;
+    gchar *end   = client -> rbuf + client -> rlen;
+    gchar *eol;
+    gint   lines = 0;
+
+    while((eol = memchr(start, '\n', end - start)) != NULL) {
+        *eol = '\0';
+        if((eol > start) && (eol[-1] == '\r')) eol[-1] = '\0';
+        nut_process_line(client, start);
+        ++lines;
+
+        /* the line may have caused the connection to be dropped */
+        if(client -> socket < 0) return lines;
+        start = eol + 1;
+    }
+
+    /* no sane reply is this long, process what we have and drop the rest */
+    if((end - start) >= MAX_LINESIZE) {
+        start[MAX_LINESIZE - 1] = '\0';
+        nut_process_line(client, start);
+        ++lines;
+        if(client -> socket < 0) return lines;
+        start = end;
+    }
+
+    client -> rlen = end - start;
+    memmove(client -> rbuf, start, client -> rlen);
+
+    return lines;
+}
+
+#endif /* #ifdef ENABLE_NUT */
 
 /*****************************************************************************\
 * Senty Bulldog specific parser and client functions.                         *
@@ -421,7 +1140,11 @@ static int ups_client_nut(gchar *acc, gchar *temp)
 
 /** Parse a string for UPS status data.
  *  This parses a string containing the status information generated
- *  by the upsd service into the supplied UPSData structure.
+ *  by the upsd service into the supplied UPSData structure. The record is
+ *  tokenised in a single pass: every tab separated field is converted by a 
+ *  simple fixed-point integer parser (the values are all in tenths) into the
+ *  val_Fields array, then the fields listed in val_fields[] are copied into
+ *  the named UPSData members.
  *
  *  \note This function does not do any real checking on the string,
  *  it assumes it is a VAL string - do not expect it to parse any 
@@ -433,27 +1156,43 @@ static int ups_client_nut(gchar *acc, gchar *temp)
  */
 static void parse_VAL(gchar *buffer, struct UPSData *target)
 {
-    buffer = skip_tabs(buffer, 5);
-    target -> bat_Voltage = (float)strtol(buffer, NULL, 10) / 10.0;
-    buffer = skip_tabs(buffer, 2);
-    target -> bat_Level = (float)strtol(buffer, NULL, 10) / 10.0;
-    buffer = skip_tabs(buffer, 1);
-    target -> in_Freq = (float)strtol(buffer, NULL, 10) / 10.0;
-    buffer = skip_tabs(buffer, 1);
-    target -> in_Voltage = (float)strtol(buffer, NULL, 10) / 10.0;
-    buffer = skip_tabs(buffer, 8);
-    target -> out_Freq = (float)strtol(buffer, NULL, 10) / 10.0;
-    buffer = skip_tabs(buffer, 1);
-    target -> out_Voltage = (float)strtol(buffer, NULL, 10) / 10.0;
-    buffer = skip_tabs(buffer, 2);
-    target -> ups_Load = (float)strtol(buffer, NULL, 10) / 10.0;
-    buffer = skip_tabs(buffer,14);
-    target -> ups_Temp = (float)strtol(buffer, NULL, 10) / 10.0;
+    gint     count = 0;
+    gint     value, field, digits;
+    gboolean negative;
+
+    while(count < MAX_VALFIELDS) {
+        while(*buffer == ' ') ++buffer;
+
+        negative = (*buffer == '-');
+        if(negative) ++buffer;
+
+        /* nine digits can't overflow, any more from a broken server are ignored */
+        for(value = 0, digits = 0; (*buffer >= '0') && (*buffer <= '9'); ++buffer) {
+            if(digits++ < 9) value = (value * 10) + (*buffer - '0');
+        }
+        target -> val_Fields[count++] = negative ? -value : value;
+
+        /* skip anything else in the field, then the tab */
+        while(*buffer && (*buffer != '\t')) ++buffer;
+        if(*buffer == '\0') break;
+        ++buffer;
+    }
+    target -> val_Count = count;
+
+    for(field = 0; val_fields[field].field >= 0; ++field) {
+        if(val_fields[field].field < count) {
+            value = target -> val_Fields[val_fields[field].field];
+        } else {
+            value = 0;
+        }
+        *(gfloat *)((gchar *)target + val_fields[field].offset) = (gfloat)value * val_fields[field].scale;
+    }
            
     if(strlen(target -> ups_LastLog) == 0) {
         set_last_log(target, gotUPS);
     }
     target -> ups_Present = TRUE;
+    target -> ups_Valid   = TRUE;
 }
 
 
@@ -505,7 +1244,8 @@ static void parse_LOG(gchar *buffer, struct UPSData *target)
  *  \arg \c target - The UPSData structure into which the results are saved.
  *  
  *  \returns 0 if the string was not a valid or parseable UPS information 
- *  string, 1 if UPSData has been modified.
+ *  string, PARSED_VAL if UPSData has new values or PARSED_LOG if only the 
+ *  log message has been modified.
  */ 
 static int parse_DeltaUPS(gchar *buffer, struct UPSData *target)
 {
@@ -535,201 +1275,770 @@ static int parse_DeltaUPS(gchar *buffer, struct UPSData *target)
     } else if(!strncmp(buffer, "LOG00", 5)) {
         /* LOG entry.. we are only interested in the log text... */
         parse_LOG(buffer, target);
+        return PARSED_LOG;
     } else {
         /* Something else we Know Not Of */
         return 0;
     }
         
-    return 1;
+    return PARSED_VAL;
 }
 
 
-/** Read data from the belkin upsd server and parse it into ups_status.
- *  The actual client work is done by this routine - it reads from the server into a temporary
- *  buffer, then the buffer is copied into an accumulator buffer until a new DeltaUPS is 
- *  encountered in the temp buffer. At this point, parseDeltaUPS() is called to parse the
- *  accumulator, then the accululator write position is reset to the start of the accumulator
- *  buffer and the copy from the temporary buffer continues.
+
+/** Locate the start of the next DeltaUPS record.
+ *  This uses memchr() to hop between candidate 'D's rather than comparing at
+ *  every offset, and never looks beyond end.
  *
- *  \par Arguments:
- *  \arg \c acc - buffer to use as an accumulator, must be at least MAX_LINESIZE characters in length.
- *  \arg \c temp - buffer to use as temporary store, again must be MAX_LINESIZE or greater.
- *  \return 0 on clean exit, 1 on forced, -1 if connection lost.
- */
-static int ups_client_belkin(gchar *acc, gchar *temp)
-{
-    gint readlen = 0;
-    gint accpos = 0;
-    gint readpos;
-    
-    /* continue reading from the server until we are told to stop or the server shuts down.
-     * (aside: This line was a bit of a problem - in testing the read() saturates the buffer
-     * for the first few calls, then the process settles down to returning 214 characters
-     * for each call to read() every second. This is fine, but if read() blocks until the 
-     * buffer is full on some machines then it could take MAX_LINELEN\214 seconds for the
-     * read to return - my temporary solution is to only use MAX_ENTRYSIZE bytes of temp
-     * with MAX_ENTRYSIZE set to 214. It's an ugly hack, but it seems to work.)
-     */
-    while(!haltThread && ((readlen = read(ups_status.ups_Socket, temp, MAX_ENTRYSIZE)) > 0)) {
-        /* haltThread may have been set while blocked in the read, this is our Emergency Exit check.. */ 
-        if(haltThread) return 1;
-
-        temp[readlen] = 0;
-
-        /* copy from the read buffer into the accumulator, parsing once a full record has been created */
-        for(readpos = 0; readpos < readlen; ++readpos, ++accpos) {
-            if(!strncmp(&temp[readpos], "DeltaUPS:", 9) || (accpos == (MAX_LINESIZE - 1))) {
-                /* null terminate the accumulator buffer and reset the write position */
-                acc[accpos] = 0;
-                accpos = 0;
-
-                /* convert the accumulator into easy to use stats, must be done inside lock */
-                g_mutex_lock(ups_status_lock);
-                parse_DeltaUPS(acc, &ups_status);
-                g_mutex_unlock(ups_status_lock);
-            }
-            acc[accpos] = temp[readpos];
-        }
+ *  \return A pointer to the start of the record, or NULL if there isn't one. If
+ *  the data ends part way through what might be a "DeltaUPS:" NULL is returned
+ *  as well - it will be found once the rest of it has been read.
+ */
+static gchar *find_record(gchar *pos, gchar *end)
+{
+    while((pos < end) && ((pos = memchr(pos, 'D', end - pos)) != NULL)) {
+        if((end - pos) < 9) return NULL;
+        if(!memcmp(pos, "DeltaUPS:", 9)) return pos;
+        ++pos;
     }
-
-    /* nothing read (lost connection/error) reset status */
-    if(readlen == 0) {
-        readlen = -1;
-        g_mutex_lock(ups_status_lock);
-        reset_status(&ups_status);
-        set_last_log(&ups_status, connLost);
-        g_mutex_unlock(ups_status_lock);
-    }        
-
-    return readlen;
+    return NULL;
 }
 
 
-/*****************************************************************************\
-* Top level client code and thread entrypoint.                                *
-\*****************************************************************************/ 
+/** Frame the data read from the belkin upsd server and parse it into the client status.
+ *  A record runs from one "DeltaUPS:" to the start of the next, so every record in the
+ *  read buffer that is followed by the start of another is complete. Complete records are
+ *  terminated in place (the 'D' of the following record is saved and restored) and handed 
+ *  straight to parse_DeltaUPS() without being copied. The incomplete record at the end of 
+ *  the buffer is moved to the start of the buffer to wait for the rest of it.
+ *
+ *  \return The number of records parsed.
+ */
+static gint belkin_frame(UPSClient *client)
+{
+    gchar *start = client -> rbuf;
+    gchar *end   = client -> rbuf + client -> rlen;
+    gchar *next;
+    gchar  save;
+    gint   records = 0;
+    gint   parsed;
+
+    /* skip anything before the first record (the tail of a record we never saw the start of) */
+    if(((end - start) < 9) || memcmp(start, "DeltaUPS:", 9)) {
+        if((start = find_record(start, end)) == NULL) {
+            /* keep enough to complete a "DeltaUPS:" split across reads */
+            start = MAX(end - 8, client -> rbuf);
+        }
+    }
 
-/** Set up the connection to the upsd service and start the client routine.
- *  This obtains the address of the host running the upsd service (normally
- *  localhost, but in theory you could remotely monitor your ups from another
- *  machine with this..), attempts to conenct to it and if it manages it the
- *  upsClient() routine is used to read into the ups_status structure.
- *
- *  \todo The host lookup, connection and other tcp/ip code is IPv4 dependant.
- *  While this is not a great problem now, it may be at some point in the 
- *  future (although right now IPv6 takeup seems to be painfully slow so it
- *  is likely to be quite some time!). Really the whole client should be
- *  protocol independant.
- *
- *  \arg \c mode  is 0 or 1 for belkin, 2 for NUT 
- *  \return -2 on error, -1 on lost connection, 0 on success.
- */
-static int ups_connect(gchar *hostname, guint port, guint mode)
-{
-    struct sockaddr_in  servaddr; /* needed for connect */
-    struct hostent     *host;
-    struct in_addr    **addrPtr;
-    gchar *accumulator;  /* This contains the string in progress.. */
-    gchar *tempStore;    /* This is filled by read() */
-    gint   result = 0;
-   
-    fprintf(stderr, "ups_connect: connecting to %s, port %d\n", hostname, port);
-    reset_status(&ups_status);
+    while((next = find_record(start + 9, end)) != NULL) {
+        save  = *next;
+        *next = '\0';
 
-    /* Yeah, this will cause all manner of fun if it picks up an IPv6 record,
-     * but for now it'll do.. */
-    if((host = gethostbyname(hostname)) == NULL) {
-        set_last_log(&ups_status, badHost);
-        return -2;
+        /* convert the record into easy to use stats and publish them */
+        if((parsed = parse_DeltaUPS(start, &client -> work)) != 0) {
+            client_publish(client, parsed == PARSED_VAL);
+            ++records;
+        }
+
+        *next = save;
+        start = next;
     }
 
-    /* Allocate the main accumulator string, Bomb if this fails.. */
-    if((accumulator = (gchar *)malloc(MAX_LINESIZE)) == NULL) {
-        set_last_log(&ups_status, noMem);
-        return -2;
+    /* no record is anything like this long, parse what we have and drop the rest */
+    if((end - start) >= MAX_LINESIZE) {
+        start[MAX_LINESIZE - 1] = '\0';
+        if((parsed = parse_DeltaUPS(start, &client -> work)) != 0) {
+            client_publish(client, parsed == PARSED_VAL);
+            ++records;
+        }
+        start = end;
     }
 
-    /* Likewise for the temporary buffer */
-    if((tempStore = (gchar *)malloc(MAX_LINESIZE)) == NULL) {
-        set_last_log(&ups_status, noMem);
-        free(accumulator);
-        return -2;
+    client -> rlen = end - start;
+    memmove(client -> rbuf, start, client -> rlen);
+
+    return records;
+}
+
+
+/** Read whatever the server has sent into the client read buffer.
+ *  The socket is readable when this is called, so the read() will not block and
+ *  returns as much as is available (up to the free space in the buffer) in one go.
+ *  (aside: the MAX_ENTRYSIZE hack used to be needed here as read() blocked until the 
+ *  buffer was full on some machines - this is no longer a problem.)
+ *
+ *  \return The number of bytes read, 0 if the connection was closed, -1 on error.
+ */
+static gint client_read(UPSClient *client)
+{
+    gint readlen;
+
+    if((readlen = read(client -> socket, client -> rbuf + client -> rlen, READ_BUFSIZE - 1 - client -> rlen)) > 0) {
+        client -> rlen += readlen;
+        stats_record(STAT_BYTES, readlen);
     }
 
-    /* Attempt to connect to the service designated by port on the hosts obtained by the
-     * call to gethostbyname(). This breaks as soon as the first successful connection is
-     * established.
-     */
-    addrPtr = (struct in_addr **)host -> h_addr_list;
-    for(; *addrPtr != NULL; ++addrPtr) {
-        if((ups_status.ups_Socket = socket(AF_INET, SOCK_STREAM, 0))) {
-            bzero(&servaddr, sizeof(servaddr));
-            servaddr.sin_family = AF_INET;
-            servaddr.sin_port = htons(port);
-            memcpy(&servaddr.sin_addr, *addrPtr, sizeof(struct in_addr));
-
-            if(connect(ups_status.ups_Socket, (struct sockaddr *)&servaddr, sizeof(servaddr)) == 0)
-                break;
+    return readlen;
+}
+
+
+/*****************************************************************************\
+* Connection handling.                                                        *
+\*****************************************************************************/ 
 
-            close(ups_status.ups_Socket);
-            ups_status.ups_Socket = 0;
+/** Called once a connection to the server has been established. 
+ *  The winning socket becomes the client socket and any other attempts still
+ *  racing are abandoned. Belkin servers start sending data as soon as we 
+ *  connect, NUT needs to be asked which UPS it has (or, if it is too old to
+ *  understand that, which variables it supports) first.
+ *
+ *  \par Arguments:
+ *  \arg \c client - Client that has connected.
+ *  \arg \c sock - The connected socket (no longer in client -> attempts).
+ */
+static void client_connected(UPSClient *client, gint sock)
+{
+    gint slot;
+
+    for(slot = 0; slot < MAX_ADDRS; ++slot) {
+        if(client -> attempts[slot] >= 0) {
+            close(client -> attempts[slot]);
+            client -> attempts[slot] = -1;
         }
     }
 
-    /* Deligate the actual communication work to the client code if a connection has
-     * been established. 
-     */
-    if(*addrPtr != NULL) {
-        if((mode == 0) || (mode == 1)) {
-            result = ups_client_belkin(accumulator, tempStore);
+    client -> socket = sock;
+    client -> state  = STATE_CONNECTED;
+    stats_since(STAT_CONNECT, client -> connect_start);
+    client -> timer  = 0;
+    client -> rlen   = 0;
+
 #ifdef ENABLE_NUT
+    if(client -> mode == MODE_NUT) {
+        client -> nut_legacy = FALSE;
+
+        if(client -> nut_ups) {
+            /* straight into polling, an old server will reject the LIST VAR */
+            client -> nut_pending = NUT_IDLE;
+            client -> timer       = 1;
         } else {
-            result = ups_client_nut(accumulator, tempStore);
+            client -> nut_pending = NUT_LISTUPS;
+            if(send_nut_command(client, "LIST", "UPS") < 0) {
+                client_disconnect(client, connLost);
+            }
+        }
+    }
 #endif
+}
+
+
+/** Drop a reference to a host lookup, freeing it when nobody else wants it.
+ */
+static void lookup_unref(UPSLookup *lookup)
+{
+    if(g_atomic_int_dec_and_test(&lookup -> refs)) {
+        if(lookup -> result) freeaddrinfo(lookup -> result);
+        g_free(lookup -> host);
+        g_free(lookup);
+    }
+}
+
+
+/** Look a host up, asking only for addresses we can make TCP connections to.
+ *  Without the hints getaddrinfo() returns stream, datagram and raw entries
+ *  for every address, filling the client's MAX_ADDRS with duplicates.
+ *
+ *  \return The getaddrinfo() return code.
+ */
+static gint resolve_host(const gchar *host, struct addrinfo **result)
+{
+    struct addrinfo hints;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_ADDRCONFIG;
+
+    return getaddrinfo(host, NULL, &hints, result);
+}
+
+
+/** Resolver thread entrypoint.
+ *  Looks up the host for a single UPSLookup, marks it done and pokes the
+ *  event loop through the wakeup pipe. If the client has already dropped its
+ *  reference there is nobody to tell, so the lookup is skipped altogether.
+ */
+static gpointer resolver_start(gpointer arg)
+{
+    UPSLookup *lookup = (UPSLookup *)arg;
+
+    if(g_atomic_int_get(&lookup -> refs) > 1) {
+        lookup -> error = resolve_host(lookup -> host, &lookup -> result);
+        g_atomic_int_inc(&lookup -> done);
+
+        if(write(wakeup[1], "", 1) < 0) { /* pipe full, the loop is awake anyway */ }
+    }
+
+    lookup_unref(lookup);
+    return NULL;
+}
+
+
+/** Copy the addresses from a completed lookup into the client.
+ *  Addresses are interleaved by family (keeping the resolver's preferred
+ *  family first) so the connection race alternates between IPv6 and IPv4.
+ *
+ *  \return The number of addresses copied.
+ */
+static gint client_store_addrs(UPSClient *client, struct addrinfo *result)
+{
+    struct addrinfo *lists[2] = { NULL, NULL };
+    struct addrinfo *entry;
+    gint             list;
+
+    client -> addr_count = 0;
+    if(result == NULL) return 0;
+
+    /* lists[0] follows the family of the first result, lists[1] the other one */
+    lists[0] = result;
+    for(entry = result; entry && !lists[1]; entry = entry -> ai_next) {
+        if(entry -> ai_family != result -> ai_family) lists[1] = entry;
+    }
+
+    for(list = 0; (lists[0] || lists[1]) && (client -> addr_count < MAX_ADDRS); list ^= 1) {
+        if((entry = lists[list]) == NULL) continue;
+
+        if(((entry -> ai_family == AF_INET) || (entry -> ai_family == AF_INET6)) &&
+           (entry -> ai_addrlen <= sizeof(struct sockaddr_storage))) {
+            memcpy(&client -> addrs[client -> addr_count], entry -> ai_addr, entry -> ai_addrlen);
+            client -> addr_lens[client -> addr_count++] = entry -> ai_addrlen;
         }
+
+        /* move this list on to the next entry of the same family */
+        for(entry = entry -> ai_next; entry && (entry -> ai_family != lists[list] -> ai_family); entry = entry -> ai_next);
+        lists[list] = entry;
+    }
+
+    return client -> addr_count;
+}
+
+
+/** Start a non-blocking connect to the next address obtained for the host.
+ *  Addresses that fail immediately are skipped. The new socket joins any
+ *  others already racing in client -> attempts, unless it connects straight
+ *  away in which case it wins immediately.
+ *
+ *  \return TRUE if an attempt was started (or won), FALSE if there are no
+ *  addresses left to try.
+ */
+static gboolean client_attempt(UPSClient *client)
+{
+    struct sockaddr_storage servaddr; /* needed for connect */
+    gint sock, slot, flags;
+
+    for(slot = 0; (slot < MAX_ADDRS) && (client -> attempts[slot] >= 0); ++slot);
+
+    while((slot < MAX_ADDRS) && (client -> addr_next < client -> addr_count)) {
+        memcpy(&servaddr, &client -> addrs[client -> addr_next], sizeof(servaddr));
+        if(servaddr.ss_family == AF_INET6) {
+            ((struct sockaddr_in6 *)&servaddr) -> sin6_port = htons(client -> port);
+        } else {
+            ((struct sockaddr_in *)&servaddr) -> sin_port = htons(client -> port);
+        }
+
+        if((sock = socket(servaddr.ss_family, SOCK_STREAM, 0)) >= 0) {
+            flags = fcntl(sock, F_GETFL, 0);
+            fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+            if(connect(sock, (struct sockaddr *)&servaddr, client -> addr_lens[client -> addr_next++]) == 0) {
+                client_connected(client, sock);
+                return TRUE;
+            } else if(errno == EINPROGRESS) {
+                /* the event loop will tell us when this has finished */
+                client -> attempts[slot] = sock;
+                return TRUE;
+            }
+
+            close(sock);
+        } else {
+            ++client -> addr_next;
+        }
+    }
+
+    return FALSE;
+}
+
+
+/** Work out whether anything is still racing for this client.
+ */
+static gboolean client_racing(UPSClient *client)
+{
+    gint slot;
+
+    for(slot = 0; slot < MAX_ADDRS; ++slot) {
+        if(client -> attempts[slot] >= 0) return TRUE;
+    }
+    return FALSE;
+}
+
+
+/** Start racing connections to the addresses in the client.
+ *  The first address is tried straight away, the client timer then starts the
+ *  others CONNECT_STAGGER apart until one of them connects or connect_timeout
+ *  runs out.
+ */
+static void client_race(UPSClient *client)
+{
+    gint64 now = now_ms();
+
+    client -> addr_next = 0;
+    client -> deadline  = now + connect_timeout;
+    client -> state     = STATE_CONNECTING;
+
+    if(!client_attempt(client)) {
+        client_disconnect(client, badConn);
+    } else if(client -> state == STATE_CONNECTING) {
+        client -> timer = MIN(now + CONNECT_STAGGER, client -> deadline);
+    }
+}
+
+
+/** Deal with a completed host lookup.
+ *  A failed lookup is only final when the host has never been found and the
+ *  resolver says it doesn't exist. Otherwise (the DNS server is having a bad
+ *  moment, upsd's host has just restarted) the addresses from the last good
+ *  lookup are tried, or if there are none the client tries again after 
+ *  RECONNECT_DELAY.
+ */
+static void client_resolved(UPSClient *client)
+{
+    UPSLookup *lookup = client -> lookup;
+    gboolean   missing;
+
+    client -> lookup = NULL;
+
+    if(!lookup -> error && client_store_addrs(client, lookup -> result)) {
+        client -> addr_expires = now_ms() + RESOLVE_TTL;
+        client_race(client);
     } else {
-        ups_status.ups_Socket = 0;
-        g_mutex_lock(ups_status_lock);
-        set_last_log(&ups_status, badConn);
-        g_mutex_unlock(ups_status_lock);
+        fprintf(stderr, "ups_connect: unable to find %s: %s\n", client -> host, 
+                lookup -> error ? gai_strerror(lookup -> error) : "no usable address");
+        missing = !lookup -> error || (lookup -> error == EAI_NONAME);
+
+        if(client -> addr_count) {
+            /* addr_expires has passed, so the next connect looks the host up again */
+            client_race(client);
+        } else if(missing && !client -> addr_expires) {
+            set_last_log(&client -> work, badHost);
+            client_publish(client, FALSE);
+            client -> state = STATE_FAILED;
+        } else {
+            client_disconnect(client, badHost);
+        }
+    }
+
+    lookup_unref(lookup);
+}
+
+
+/** Set up the connection to the upsd service.
+ *  This obtains the addresses of the host running the upsd service (normally
+ *  localhost, but in theory you could remotely monitor your ups from another
+ *  machine with this..) and races non-blocking connections to them. The
+ *  event loop takes over from there.
+ *
+ *  Addresses are kept for RESOLVE_TTL so reconnecting after the server 
+ *  restarts does not have to wait for a lookup. getaddrinfo() does not tell us
+ *  the real DNS TTL, so this is a fixed (short) interval. When a lookup is 
+ *  needed it is done on a thread of its own so it never blocks the event loop.
+ */
+static void ups_connect(UPSClient *client)
+{
+    UPSLookup *lookup;
+    gint port;
+   
+    if(client -> mode == MODE_LOCAL) {
+        port = process_pronet(client -> pro_net);
+        if(port) {
+            client -> port = port;
+        }
     }
 
-    if(ups_status.ups_Socket) {
-        close(ups_status.ups_Socket);
-        ups_status.ups_Socket = 0;
+    fprintf(stderr, "ups_connect: connecting to %s, port %d\n", client -> host, client -> port);
+    client -> connect_start = stats_now();
+
+    reset_status(&client -> work);
+    client_publish(client, FALSE);
+
+    if(client -> addr_count && (now_ms() < client -> addr_expires)) {
+        client_race(client);
+        return;
     }
 
-    free(accumulator);
-    free(tempStore);
+    lookup = g_new0(UPSLookup, 1);
+    lookup -> host = g_strdup(client -> host);
+    lookup -> refs = 2; /* one for us, one for the resolver */
 
-    return(result);
+    client -> lookup = lookup;
+    client -> state  = STATE_RESOLVING;
+
+    if(!g_thread_create(resolver_start, lookup, FALSE, NULL)) {
+        /* no thread, do it the slow way */
+        lookup -> error = resolve_host(lookup -> host, &lookup -> result);
+        g_atomic_int_inc(&lookup -> done);
+        lookup_unref(lookup);
+        client_resolved(client);
+    }
+}
+
+
+/** Deal with poll() reporting activity on a client socket.
+ *  Completes pending connections and passes readable sockets to the 
+ *  protocol specific client code.
+ *
+ *  \par Arguments:
+ *  \arg \c client - Client the socket belongs to.
+ *  \arg \c fd - The socket poll() reported on.
+ *  \arg \c revents - What poll() reported.
+ */
+static void client_io(UPSClient *client, gint fd, gshort revents)
+{
+    gint      result = 0, slot, records;
+    socklen_t len    = sizeof(result);
+    gint64    start;
+
+    if(client -> state == STATE_CONNECTING) {
+        for(slot = 0; (slot < MAX_ADDRS) && (client -> attempts[slot] != fd); ++slot);
+        if(slot == MAX_ADDRS) return;
+
+        if((getsockopt(fd, SOL_SOCKET, SO_ERROR, &result, &len) < 0) || result) {
+            close(fd);
+            client -> attempts[slot] = -1;
+
+            /* don't wait for the stagger timer, try the next address now */
+            if(!client_attempt(client) && !client_racing(client)) {
+                client_disconnect(client, badConn);
+            }
+        } else {
+            client -> attempts[slot] = -1;
+            client_connected(client, fd);
+        }
+        return;
+    }
+
+    if(fd != client -> socket) return;
+
+    result = client_read(client);
+
+    /* nothing read (lost connection/error) reset status */
+    if((result == 0) || ((result < 0) && (errno != EAGAIN) && (errno != EINTR))) {
+        client_disconnect(client, connLost);
+        return;
+    }
+
+    start = client -> received = stats_now();
+#ifdef ENABLE_NUT
+    if(client -> mode == MODE_NUT) {
+        records = nut_frame(client);
+    } else
+#endif
+    {
+        records = belkin_frame(client);
+    }
+    stats_since(STAT_PARSE, start);
+    stats_tally(STAT_RECORDS, records);
+}
+
+
+/** Deal with a client timer expiring.
+ *  Idle clients are reconnected, connected NUT clients are due a poll.
+ */
+static void client_timer(UPSClient *client)
+{
+    gint64 now = now_ms();
+
+    client -> timer = 0;
+
+    switch(client -> state) {
+        case STATE_IDLE:      ups_connect(client);
+                              break;
+        case STATE_CONNECTING:
+                              if(now >= client -> deadline) {
+                                  fprintf(stderr, "ups_connect: timed out connecting to %s\n", client -> host);
+                                  client_disconnect(client, badConn);
+                              } else if(client_attempt(client) && (client -> state == STATE_CONNECTING)) {
+                                  client -> timer = MIN(now + CONNECT_STAGGER, client -> deadline);
+                              } else if(client -> state == STATE_CONNECTING) {
+                                  /* nothing left to start, just wait for the ones in flight */
+                                  client -> timer = client -> deadline;
+                              }
+                              break;
+#ifdef ENABLE_NUT
+        case STATE_CONNECTED: if(client -> mode == MODE_NUT) nut_start_poll(client);
+                              break;
+#endif
+    }
+}
+
+
+/*****************************************************************************\
+* PRO_NET.DAT watching.                                                       *
+\*****************************************************************************/ 
+
+#ifdef __linux__
+
+/** Start watching PRO_NET.DAT for changes.
+ *  The Bulldog upsd writes the port it is listening on to PRO_NET.DAT when 
+ *  it starts. Rather than wait for a reconnect to notice a new port, the 
+ *  directory the file is in is watched with inotify (the file itself may be
+ *  replaced, or not exist yet) and pronet_changed() acts as soon as it has 
+ *  been written.
+ *
+ *  \par Arguments:
+ *  \arg \c filename - Location of PRO_NET.DAT.
+ */
+static void pronet_watch(const gchar *filename)
+{
+    gchar *dirname;
+
+    if(!filename || !*filename || (pronet_fd >= 0)) return;
+
+    if((pronet_fd = inotify_init()) < 0) {
+        perror("pronet_watch: unable to create inotify descriptor");
+        return;
+    }
+    fcntl(pronet_fd, F_SETFL, O_NONBLOCK);
+
+    dirname     = g_path_get_dirname(filename);
+    pronet_name = g_path_get_basename(filename);
+    if(inotify_add_watch(pronet_fd, dirname, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "pronet_watch: unable to watch %s: %s\n", dirname, strerror(errno));
+        close(pronet_fd);
+        pronet_fd = -1;
+    }
+    g_free(dirname);
+}
+
+
+/** Stop watching PRO_NET.DAT.
+ */
+static void pronet_unwatch(void)
+{
+    if(pronet_fd >= 0) close(pronet_fd);
+    pronet_fd = -1;
+
+    g_free(pronet_name);
+    pronet_name = NULL;
+}
+
+
+/** Read the inotify events and deal with PRO_NET.DAT having been written.
+ *  A local client that is on another port is moved over to the new one 
+ *  straight away, and one waiting to reconnect tries again now (upsd has 
+ *  just started, so there is no point waiting for RECONNECT_DELAY).
+ */
+static void pronet_changed(void)
+{
+    gchar                 buffer[4096];
+    struct inotify_event *event;
+    UPSClient            *local;
+    gboolean              written = FALSE;
+    gint                  len, pos, client, port;
+
+    while((len = read(pronet_fd, buffer, sizeof(buffer))) > 0) {
+        for(pos = 0; pos + (gint)sizeof(struct inotify_event) <= len; pos += sizeof(struct inotify_event) + event -> len) {
+            event = (struct inotify_event *)(buffer + pos);
+            if(event -> len && !strcmp(event -> name, pronet_name)) written = TRUE;
+        }
+    }
+    if(!written) return;
+
+    for(client = 0; client < client_count; ++client) {
+        local = clients[client];
+        if((local -> mode != MODE_LOCAL) || !(port = process_pronet(local -> pro_net))) continue;
+
+        if(port != local -> port) {
+            fprintf(stderr, "pronet_changed: upsd is now on port %d (was %d)\n", port, local -> port);
+            local -> port = port;
+            if((local -> state == STATE_CONNECTED) || (local -> state == STATE_CONNECTING)) {
+                client_close(local, connLost);
+            }
+        }
+
+        /* reconnect straight away, a lookup in progress connects to the new port when it finishes */
+        if((local -> state == STATE_IDLE) || (local -> state == STATE_FAILED)) {
+            local -> state = STATE_IDLE;
+            local -> timer = now_ms();
+        }
+    }
+}
+
+
+/** Fill in the pollfd for the PRO_NET.DAT watch.
+ *
+ *  \return The number of pollfds used, 0 if PRO_NET.DAT is not being watched.
+ */
+static gint pronet_pollfd(struct pollfd *fd)
+{
+    if(pronet_fd < 0) return 0;
+
+    fd -> fd      = pronet_fd;
+    fd -> events  = POLLIN;
+    fd -> revents = 0;
+    return 1;
+}
+
+#else
+
+/* no inotify, the port is only read again when reconnecting */
+static void pronet_watch(const gchar *filename) { }
+static void pronet_unwatch(void) { }
+static void pronet_changed(void) { }
+static gint pronet_pollfd(struct pollfd *fd) { return 0; }
+
+#endif
+
+
+/*****************************************************************************\
+* Top level client code and thread entrypoint.                                *
+\*****************************************************************************/ 
+
+/** Render the metrics response from the state of every client.
+ *  Called by the event loop when a scrape arrives and a sample has been 
+ *  published since the last render, so however often Prometheus scrapes the
+ *  response is rendered at most once per sample.
+ */
+static void client_metrics(void)
+{
+    BUPSMetricsEndpoint endpoints[MAX_ENDPOINTS];
+    gint                client;
+
+    for(client = 0; client < client_count; ++client) {
+        endpoints[client].name    = clients[client] -> label;
+        endpoints[client].sample  = &clients[client] -> shared;
+        endpoints[client].samples = clients[client] -> samples;
+        endpoints[client].state   = metrics_states[clients[client] -> state];
+        endpoints[client].status  = NULL;
+        endpoints[client].latency = NULL;
+#ifdef ENABLE_NUT
+        if(clients[client] -> mode == MODE_NUT) {
+            endpoints[client].status  = clients[client] -> nut_status;
+            endpoints[client].latency = &clients[client] -> nut_latency;
+        }
+#endif
+    }
+
+    metrics_render(endpoints, client_count);
+    metrics_stale = FALSE;
 }
 
 
 /** ups client thread entrypoint.
- *  The launchClient() function uses this as the start routine argument to a
- *  g_thread_create() call. This is simply a wrapper for the upsdConnect()
- *  function which fills in the host and port from global variables.
+ *  The launch_client() function uses this as the start routine argument to a
+ *  g_thread_create() call. This is a single poll() based event loop which 
+ *  services every client in clients[], handling their timers and socket
+ *  activity without ever blocking on any one of them.
  */
 gpointer ups_start(gpointer arg)
 {
-    int result = 0;
-    int port;
+    struct pollfd  fds[(MAX_ENDPOINTS * MAX_ADDRS) + METRICS_MAX_CONNS + 3];
+    UPSClient     *owner[(MAX_ENDPOINTS * MAX_ADDRS) + METRICS_MAX_CONNS + 3];
+    gchar          drain[64];
+    gint64         now;
+    gint           timeout, count, nfds, client, slot, metrics, watched, base;
+
+    while(!haltThread) {
+        now     = now_ms();
+        timeout = -1;
+
+        /* slot 0 is always the wakeup pipe, so halt_client() and the resolver can interrupt poll() */
+        fds[0].fd      = wakeup[0];
+        fds[0].events  = POLLIN;
+        fds[0].revents = 0;
+        owner[0]       = NULL;
+
+        /* slot 1 is the PRO_NET.DAT watch, if there is one */
+        watched = pronet_pollfd(fds + 1);
+        owner[1] = NULL;
+        base = nfds = 1 + watched;
+
+        /* then the metrics listener and any scrapes in progress, see metrics.c */
+        metrics = metrics_pollfds(fds + base, now, &timeout);
+        for(slot = base; slot < base + metrics; ++slot) owner[slot] = NULL;
+        nfds += metrics;
+
+        for(client = 0; client < client_count; ++client) {
+            if(clients[client] -> lookup && g_atomic_int_get(&clients[client] -> lookup -> done)) {
+                client_resolved(clients[client]);
+            }
+
+            if(clients[client] -> timer && (clients[client] -> timer <= now)) {
+                client_timer(clients[client]);
+            }
+
+            if(clients[client] -> timer) {
+                gint wait = (gint)MAX(clients[client] -> timer - now, 0);
 
-    /* attempt to reconnect after lost connections */
-    while(!haltThread && (result != -2)) {
-        result = ups_connect(ups_host, ups_port, ups_mode);
+                timeout = (timeout < 0) ? wait : MIN(timeout, wait);
+            }
 
-        if(ups_mode == 2) {
-            port = process_pronet(pro_net_loc);
-            if(port) {
-                ups_port = port;
+            if(clients[client] -> socket >= 0) {
+                fds[nfds].fd      = clients[client] -> socket;
+                fds[nfds].events  = POLLIN;
+                fds[nfds].revents = 0;
+                owner[nfds++]     = clients[client];
+            }
+
+            for(slot = 0; slot < MAX_ADDRS; ++slot) {
+                if(clients[client] -> attempts[slot] >= 0) {
+                    fds[nfds].fd      = clients[client] -> attempts[slot];
+                    fds[nfds].events  = POLLOUT;
+                    fds[nfds].revents = 0;
+                    owner[nfds++]     = clients[client];
+                }
+            }
+        }
+
+        if((count = poll(fds, nfds, timeout)) > 0) {
+            if(fds[0].revents) {
+                while(read(wakeup[0], drain, sizeof(drain)) > 0);
+            }
+
+            if(watched && fds[1].revents) pronet_changed();
+
+            if(metrics_waiting(fds + base, metrics)) {
+                if(metrics_stale) client_metrics();
+                for(slot = base; slot < base + metrics; ++slot) {
+                    if(fds[slot].revents) metrics_io(fds[slot].fd, fds[slot].revents);
+                }
+            }
+
+            for(client = base + metrics; (client < nfds) && !haltThread; ++client) {
+                /* client_io() checks the socket is still one the client owns, an earlier one may have won the race */
+                if(fds[client].revents) {
+                    client_io(owner[client], fds[client].fd, fds[client].revents);
+                }
             }
         }
-        fprintf(stderr, "ups_start: failed. Sleeping\n");
-        if(!haltThread) sleep(5);
     }
 
+    for(client = 0; client < client_count; ++client) {
+        if(clients[client] -> socket >= 0) {
+            close(clients[client] -> socket);
+            clients[client] -> socket = -1;
+        }
+
+        for(slot = 0; slot < MAX_ADDRS; ++slot) {
+            if(clients[client] -> attempts[slot] >= 0) {
+                close(clients[client] -> attempts[slot]);
+                clients[client] -> attempts[slot] = -1;
+            }
+        }
+    }
+
+    metrics_close();
+
     fprintf(stderr, "ups_start: exiting\n");
     return NULL;
 }
@@ -739,33 +2048,135 @@ gpointer ups_start(gpointer arg)
 * thread creation and shutdown functions.                                     *
 \*****************************************************************************/ 
 
+/** Create a new client context for the specified server.
+ *  The client starts out idle with its timer already expired, so the event
+ *  loop will connect it as soon as it starts.
+ *
+ *  \par Arguments:
+ *  \arg \c host - Host the server is running on. For NUT this may be given as
+ *                 "upsname@host" (as upsc does) to pick a UPS on the server.
+ *  \arg \c port - Port the server is listening on.
+ *  \arg \c mode - MODE_LOCAL, MODE_REMOTE or MODE_NUT.
+ *  \arg \c pro_net - Location of PRO_NET.DAT (only used in local mode).
+ */
+static UPSClient *client_new(const gchar *host, gint port, gint mode, const gchar *pro_net)
+{
+    UPSClient *client = g_new0(UPSClient, 1);
+    gint       slot;
+
+    client -> host    = g_strdup(host);
+    client -> label   = g_strdup_printf("%s:%d", host, port);
+#ifdef ENABLE_NUT
+    if((mode == MODE_NUT) && strchr(host, '@')) {
+        client -> nut_ups = client -> host;
+        client -> host    = g_strdup(strchr(host, '@') + 1);
+        *strchr(client -> nut_ups, '@') = '\0';
+    }
+#endif
+    client -> port    = port;
+    client -> mode    = mode;
+    client -> pro_net = g_strdup(pro_net ? pro_net : "");
+    client -> socket  = -1;
+    client -> state   = STATE_IDLE;
+    client -> timer   = 1;
+    for(slot = 0; slot < MAX_ADDRS; ++slot) {
+        client -> attempts[slot] = -1;
+    }
+#ifdef ENABLE_NUT
+    client -> nut_pending = NUT_IDLE;
+#endif
+
+    reset_status(&client -> work);
+    client_publish(client, FALSE);
+
+    return client;
+}
+
+
+/** Release a client context created by client_new().
+ */
+static void client_free(UPSClient *client)
+{
+    /* a resolver thread may still be running, it cleans up after itself */
+    if(client -> lookup) lookup_unref(client -> lookup);
+
+    g_free(client -> host);
+    g_free(client -> label);
+#ifdef ENABLE_NUT
+    g_free(client -> nut_ups);
+#endif
+    g_free(client -> pro_net);
+    g_free(client);
+}
+
+
 /** Create the client thread and return the thread id.
- *  This creates a new client which connects to hostname and port. Directly
- *  creating the thread using upsStart() is fine if the host and port are
- *  unchanged from the last call to launchClient(), but in general this 
- *  should always be used when creating clients.
+ *  This creates a client context for the server selected in the config and one
+ *  for each of the additional endpoints listed in the config, then starts the
+ *  event loop thread which services them all. The first client is the one
+ *  the charts show. In MODE_GKRELLMD gkrellmd does the polling, so no thread 
+ *  is started and NULL is returned.
  */
 GThread *launch_client(BUPSConfig *config)
 {
-    gkrellm_dup_string(&pro_net_loc, config -> pro_net);
+    gint endpoint;
+
+    /* make sure threads are enabled... */
+    if(!g_thread_supported()) g_thread_init(NULL);
+
+    /* the pipe lives as long as gkrellm does, resolver threads may outlive the client thread */
+    if(wakeup[0] < 0) {
+        if(pipe(wakeup) < 0) {
+            perror("launch_client: unable to create wakeup pipe");
+            wakeup[0] = wakeup[1] = -1;
+            return NULL;
+        }
+        fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+    }
+
+    connect_timeout = (config -> connect_timeout > 0) ? config -> connect_timeout : DEFAULT_CONNECT_TIMEOUT;
+
+    /* gkrellmd does the polling, the data turns up in ups_serve_input() */
+    serving = (config -> mode == MODE_GKRELLMD);
+    if(serving) {
+        reset_status(&served);
+        set_last_log(&served, noServer);
+        served.log_Seq    = ++served_logs;
+        served_generation = 0;
+        served.ups_Seq    = 0;
+        served_taken      = 0;
+        return NULL;
+    }
+
+    shm_open_segment();
+    metrics_open(config -> metrics_listen);
+    if(config -> mode == MODE_LOCAL) pronet_watch(config -> pro_net);
+    metrics_stale = TRUE;
 
     switch(config -> mode) {
-        case 0: gkrellm_dup_string(&ups_host, "localhost");
-                ups_port = process_pronet(pro_net_loc);
+        case 0: clients[0] = client_new("localhost", process_pronet(config -> pro_net), config -> mode, config -> pro_net);
                 break;
-        case 1: gkrellm_dup_string(&ups_host, config -> belkin_host);
-                ups_port = config -> belkin_port;
+        case 1: clients[0] = client_new(config -> belkin_host, config -> belkin_port, config -> mode, NULL);
                 break;
-        case 2: gkrellm_dup_string(&ups_host, config -> nut_host);
-                ups_port = config -> nut_port;
+        default: clients[0] = client_new(config -> nut_host, config -> nut_port, config -> mode, NULL);
                 break;
     }
+    client_count = 1;
 
-    ups_mode = config -> mode;
+    for(endpoint = 0; (endpoint < config -> endpoint_count) && (client_count < MAX_ENDPOINTS); ++endpoint) {
+        clients[client_count++] = client_new(config -> endpoints[endpoint].host,
+                                             config -> endpoints[endpoint].port,
+                                             config -> endpoints[endpoint].mode, 
+                                             config -> pro_net);
+    }
 
-    /* make sure threads are enabled... */
-    if(!g_thread_supported()) g_thread_init(NULL);
-    if(ups_status_lock == NULL) ups_status_lock = g_mutex_new();
+    for(endpoint = 0; endpoint < client_count; ++endpoint) clients[endpoint] -> endpoint = endpoint;
+
+    /* bad rules are reported and skipped */
+    alert_clear();
+    for(endpoint = 0; endpoint < config -> alert_count; ++endpoint) alert_add(config -> alerts[endpoint]);
+    alert_start();
 
     return g_thread_create(ups_start, NULL, TRUE, NULL);
 }
@@ -777,20 +2188,24 @@ GThread *launch_client(BUPSConfig *config)
  */
 void halt_client(GThread *tid)
 {
+    gint client;
+
     haltThread = TRUE;
 
-    /* got to be a better way to take the client out ... :/ */
-    g_thread_join(tid);
+    /* kick the event loop out of poll(), it never blocks anywhere else */
+    if(tid) {
+        if(write(wakeup[1], "", 1) < 0) perror("halt_client: unable to wake client thread");
+        g_thread_join(tid);
+    }
     haltThread = FALSE;
 
-    if(pro_net_loc) {
-        g_free(pro_net_loc);
-        pro_net_loc = NULL;
-    }    
+    /* nothing can queue an alert now the client thread has gone */
+    alert_stop();
+    pronet_unwatch();
 
-    if(ups_host) {
-        g_free(ups_host);
-        ups_host = NULL;
-    }            
+    for(client = 0; client < client_count; ++client) {
+        client_free(clients[client]);
+        clients[client] = NULL;
+    }
+    client_count = 0;
 }
-    
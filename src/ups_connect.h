@@ -34,12 +34,16 @@
 /*! Maximum size of a single DeltaUPS line (the largest I've found is around 350 chars)   */
 #define MAX_LINESIZE 1024
 
-/*! Maximum size of a single entry (see the aside in upsClient() for more on this #define */
-#define MAX_ENTRYSIZE 213
-
 /*! Maximum length of a line in PRO_NET.DAT.                                              */
 #define MAX_PRONET   512
 
+/*! Maximum number of fields kept from a DeltaUPS VAL record (I've seen around 40).        */
+#define MAX_VALFIELDS 64
+
+/*! Samples each endpoint can queue for ups_take_sample(), a power of two. Enough for a 
+ *  full read buffer of the VAL records upsd dumps on connect.                            */
+#define SAMPLE_QUEUE  256
+
 /** Structure to store UPS status values.
  *  This contains all the values I have been able to reverse engineer from the
  *  upsd output. The ups connect code attemps to parse the output of upsd into
@@ -56,18 +60,29 @@ struct UPSData
     gfloat   ups_Load;                 /*!< Connected load value */
     gfloat   ups_Temp;                 /*!< Internal temperature. */
     gchar    ups_LastLog[MAX_LOGSIZE]; /*!< Last log message (or error message from us...) */
+    guint    log_Seq;                  /*!< Changes every time ups_LastLog does. */
+    guint    ups_Seq;                  /*!< Number of samples with new values published, this one included. */
     gboolean ups_Present;              /*!< TRUE if UPS connected, FALSE otherwise.  */
-    int      ups_Socket;               /*!< Socket which is connected to the upsd service. */
+    gint     val_Fields[MAX_VALFIELDS]; /*!< Raw values (usually tenths) of every field in the last VAL record. */
+    gint     val_Count;                /*!< Number of valid entries in val_Fields. */
+    gint64   ups_Time;                 /*!< Wall clock time the sample was published (seconds since the epoch). */
+    gint64   ups_Stamp;                /*!< Monotonic time (ms) the sample was published, 0 if not known. */
+    gboolean ups_Valid;                /*!< TRUE if the values were read from the UPS, FALSE while disconnected. */
+    gboolean ups_Lost;                 /*!< TRUE if ups_take_sample() skipped samples before this one. */
 };
 
-/* global variables exported from ups_connect.c 
- *
- */
-extern struct UPSData  ups_status;      /*!< Global UPS data structure, must be synchronised across threads! */
-extern GMutex    *ups_status_lock; /*!< Synchronisation mutex for upsStatus.                            */
+/*! Per-endpoint client context, private to ups_connect.c. */
+typedef struct UPSClient UPSClient;
+
+/*! Function called on the main loop when new samples have been published, see ups_notify(). */
+typedef void (*UPSNotifyFunc)(void);
 
 /* functions exported from ups_connect.c */
 extern GThread* launch_client(BUPSConfig *config); /*!< Create the client thread and return the thread id. */
 extern void     halt_client  (GThread* tid);      /*!< Force the specified client thread to exit.         */ 
+extern guint    ups_read_status(gint endpoint, struct UPSData *dest); /*!< Copy the last published sample. */
+extern void     ups_serve_input(gchar *line);     /*!< Apply an update from the gkrellmd server plugin.   */
+extern void     ups_notify   (UPSNotifyFunc func); /*!< Set the function called when samples are published. */
+extern gboolean ups_take_sample(gint endpoint, struct UPSData *dest); /*!< Take the oldest queued sample.  */
 
 #endif